@@ -0,0 +1,36 @@
+#!/bin/sh
+# Builds the firmware for the PC (Controller_Sim) and Serial_Bench, runs the benchmark against it, and compares with a baseline.
+# The first run records the baseline. Every run after that exits 1 if throughput or p99 latency got worse than the thresholds allow.
+#
+# Usage: tools/Bench_Sim.sh [baseline.json] [baud]
+# Anything in SIM_ARGS is passed to Controller_Sim, anything in BENCH_ARGS is passed to Serial_Bench.
+# Every command waits on the simulated Dynamixel bus at 57600 baud, so each workload defaults to 200 commands instead of 2000 to keep a run under a minute. BENCH_ARGS can change it.
+
+set -e
+
+TOOLS=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(dirname "$TOOLS")
+BASELINE=${1:-bench_baseline.json}
+BAUD=${2:-115200}
+WORK=$(mktemp -d)
+LINK="$WORK/VM200_Sim"
+
+# Same -D flags as build_flags in platformio.ini
+g++ -O2 -std=c++17 -funsigned-char -D DXL_SERIAL=Serial1 -D PC_SERIAL=Serial -I "$ROOT/include" -I "$TOOLS/native" \
+    -o "$WORK/Controller_Sim" "$ROOT/src/main.cpp" "$TOOLS/Controller_Sim.cpp"
+g++ -O2 -std=c++17 -o "$WORK/Serial_Bench" "$TOOLS/Serial_Bench.cpp"
+
+"$WORK/Controller_Sim" --baud "$BAUD" --link "$LINK" $SIM_ARGS > /dev/null &
+SIM=$!
+trap 'kill $SIM 2>/dev/null; rm -rf "$WORK"' EXIT
+
+# Wait for the simulator to make its pty link
+for x in 1 2 3 4 5 6 7 8 9 10; do [ -e "$LINK" ] && break; sleep 0.1; done
+
+set +e
+if [ -f "$BASELINE" ]; then
+  "$WORK/Serial_Bench" --port "$LINK" --baud "$BAUD" --count 200 --baseline "$BASELINE" $BENCH_ARGS
+else
+  "$WORK/Serial_Bench" --port "$LINK" --baud "$BAUD" --count 200 --output "$BASELINE" $BENCH_ARGS && echo "Recorded baseline in $BASELINE"
+fi
+exit $?
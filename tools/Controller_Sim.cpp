@@ -0,0 +1,330 @@
+// Controller_Sim - Runs the real controller firmware on a Linux PC, talking to the PC on a pseudo terminal and to a simulated Dynamixel
+// Runs on a Linux PC, not on the Teensy. Build from the top of the repo with:
+//   g++ -O2 -std=c++17 -funsigned-char -D DXL_SERIAL=Serial1 -D PC_SERIAL=Serial -I include -I tools/native -o Controller_Sim src/main.cpp tools/Controller_Sim.cpp
+// Version Info : 2.0
+
+/*
+   What is this? src/main.cpp, include/Serial_Functions.h and include/EEPROM_Functions.h built for the PC instead of the Teensy. The headers in tools/native stand in for the
+   Arduino core, Dynamixel2Arduino and the FRAM library, and this file supplies the parts of them that are not inline: the clock, PC_SERIAL on one end of a pty pair, and a
+   main() that calls setup() once and then loop() forever. Serial_Bench (or the daemon, or any other PC software) can be pointed at the other end of the pty without a controller
+   plugged in, and every answer it gets comes from the firmware's own Serial_Parse and Serial_Respond.
+
+   Use the same -D flags as build_flags in platformio.ini. The Dynamixel type is whichever #define is set at the top of main.cpp, just like on the Teensy.
+
+   Timing:
+     - PC line: every byte takes 10 bit times at --baud (8N1) in both directions. A byte only shows up in PC_SERIAL.available() once its last bit would have arrived, and a byte
+       written by the firmware only reaches the pty once its last bit would have been sent. --baud 0 turns the line model off.
+     - Dynamixel bus: every ping, read and write waits as long as its packets would take at the baud rate setup() gives dxl.begin(), plus --return-delay-us
+       (see tools/native/Dynamixel2Arduino.h). Extra pings or reads in Serial_Parse make every command slower, just like on a real controller.
+     - Everything else is the firmware running at the PC's speed, which is a lot faster than a Teensy at 24MHz.
+
+   Benchmark against it:
+     ./Controller_Sim --baud 115200 --link /tmp/VM200_Sim &
+     ./Serial_Bench --port /tmp/VM200_Sim --baud 115200 --output baseline.json               (once, to record the baseline)
+     ./Serial_Bench --port /tmp/VM200_Sim --baud 115200 --baseline baseline.json             (exits 1 on a regression)
+   tools/Bench_Sim.sh does all of this in one go.
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "Dynamixel2Arduino.h"
+
+// ********************************************************************************************************************************************************************************************
+// Settings, changed from the command line
+// ********************************************************************************************************************************************************************************************
+
+struct Sim_Settings
+{
+  long          Baud = 115200;                          // Modeled PC line speed, 0 for no line model
+  std::string   Link;                                   // Symlink made to the pty so other programs have a fixed path to open
+};
+
+static Sim_Settings          Settings;
+static volatile sig_atomic_t Running = 1;
+static int                   Master_Fd = -1;            // Our end of the pty, the PC software opens the other end
+
+static void Stop_Running(int)
+{
+  Running = 0;
+}
+
+static void Remove_Link()
+{
+  if (!Settings.Link.empty()) unlink(Settings.Link.c_str());
+}
+
+// ********************************************************************************************************************************************************************************************
+// What the Arduino core and the libraries would normally provide
+// ********************************************************************************************************************************************************************************************
+
+HardwareSerial        Serial;
+HardwareSerial        Serial1;
+Native_Servo_Settings Native_Servo;
+
+static uint64_t       Boot_ns;                          // millis() and micros() count from here, like they count from power up on the Teensy
+
+uint64_t Native_Now_ns()
+{
+  struct timespec Now;
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  return (uint64_t)Now.tv_sec * 1000000000ull + Now.tv_nsec;
+}
+
+unsigned long millis()
+{
+  return (unsigned long)((Native_Now_ns() - Boot_ns) / 1000000ull);
+}
+
+unsigned long micros()
+{
+  return (unsigned long)((Native_Now_ns() - Boot_ns) / 1000ull);
+}
+
+// Sleeps until Deadline_ns, or only until the PC sends something if Wake_On_Input is set. Nanosecond timeouts, a byte at 115200 baud only takes 87us.
+// This is also where the firmware gets stopped, because Fault_Condition() never returns.
+static void Wait(uint64_t Deadline_ns, bool Wake_On_Input)
+{
+  while (true)
+  {
+    uint64_t Now = Native_Now_ns();
+    Serial.Service(Now);
+    if (!Running)
+    {
+      exit(0);
+    }
+    if (Now >= Deadline_ns) return;
+
+    uint64_t Wake = std::min(Deadline_ns, Serial.Next_Event_ns(Now));
+    uint64_t Sleep = Wake > Now ? Wake - Now : 0;
+    struct timespec Timeout = { (time_t)(Sleep / 1000000000ull), (long)(Sleep % 1000000000ull) };
+    struct pollfd Input = { Master_Fd, POLLIN, 0 };
+    if (ppoll(&Input, 1, &Timeout, nullptr) > 0 && Wake_On_Input)
+    {
+      Serial.Service(Native_Now_ns());
+      return;
+    }
+  }
+}
+
+void Native_Wait_Until(uint64_t Deadline_ns)
+{
+  Wait(Deadline_ns, false);
+}
+
+void delay(unsigned long ms)
+{
+  Native_Wait_Until(Native_Now_ns() + ms * 1000000ull);
+}
+
+// ********************************************************************************************************************************************************************************************
+// PC_SERIAL on the pty
+// ********************************************************************************************************************************************************************************************
+
+void HardwareSerial::Attach(int Port_Fd, long Baud)
+{
+  Fd = Port_Fd;
+  Byte_Time_ns = Baud > 0 ? 10000000000ull / Baud : 0;
+}
+
+// Bytes from the PC are stamped with when they would have finished arriving on a real line. Bytes for the PC are written once their last bit would have been sent.
+void HardwareSerial::Service(uint64_t Now)
+{
+  if (Fd < 0) return;
+
+  uint8_t Buffer[4096];
+  ssize_t Got;
+  while ((Got = ::read(Fd, Buffer, sizeof(Buffer))) > 0)
+  {
+    for (ssize_t x = 0; x < Got; x++)
+    {
+      Rx_Line_Free_ns = std::max(Rx_Line_Free_ns, Now) + Byte_Time_ns;
+      Rx.push_back({ Rx_Line_Free_ns, Buffer[x] });
+    }
+  }
+
+  size_t Due = 0;
+  while (Due < Tx.size() && Due < sizeof(Buffer) && Tx[Due].Time_ns <= Now)
+  {
+    Buffer[Due] = Tx[Due].Value;
+    Due++;
+  }
+  if (Due > 0)
+  {
+    // If the pty is full because nobody is reading, the bytes are lost, just like the Teensy's USB serial when the PC is not listening
+    ssize_t Written = ::write(Fd, Buffer, Due);
+    Tx.erase(Tx.begin(), Tx.begin() + (Written > 0 ? (size_t)Written : Due));
+  }
+}
+
+uint64_t HardwareSerial::Next_Event_ns(uint64_t Now) const
+{
+  uint64_t Earliest = Tx.empty() ? UINT64_MAX : Tx.front().Time_ns;
+  for (const Timed_Byte &Byte : Rx)
+  {
+    if (Byte.Time_ns > Now)
+    {
+      Earliest = std::min(Earliest, Byte.Time_ns);
+      break;
+    }
+  }
+  return Earliest;
+}
+
+size_t HardwareSerial::Arrived(uint64_t Now) const
+{
+  size_t Count = 0;
+  while (Count < Rx.size() && Rx[Count].Time_ns <= Now) Count++;
+  return Count;
+}
+
+int HardwareSerial::available()
+{
+  uint64_t Now = Native_Now_ns();
+  Service(Now);
+  return (int)Arrived(Now);
+}
+
+int HardwareSerial::peek()
+{
+  return Arrived(Native_Now_ns()) > 0 ? Rx.front().Value : -1;
+}
+
+int HardwareSerial::read()
+{
+  if (Arrived(Native_Now_ns()) == 0) return -1;
+  int Value = Rx.front().Value;
+  Rx.pop_front();
+  Read_Count++;
+  return Value;
+}
+
+size_t HardwareSerial::write(uint8_t Value)
+{
+  uint64_t Now = Native_Now_ns();
+  Tx_Line_Free_ns = std::max(Tx_Line_Free_ns, Now) + Byte_Time_ns;
+  Tx.push_back({ Tx_Line_Free_ns, Value });
+  Service(Now);
+  return 1;
+}
+
+// ********************************************************************************************************************************************************************************************
+// Command line
+// ********************************************************************************************************************************************************************************************
+
+static void Usage()
+{
+  fprintf(stderr,
+    "Usage: Controller_Sim [options]\n"
+    "  --baud N                   Modeled PC line speed, 10 bits per byte (default 115200, 0 for no line model)\n"
+    "  --return-delay-us N        Dynamixel return delay per packet (default 500)\n"
+    "  --speed N                  Dynamixel speed in counts per second (default 20000)\n"
+    "  --start N                  Dynamixel start position (default 0)\n"
+    "  --link PATH                Make PATH a symlink to the pty\n");
+}
+
+static bool Parse_Arguments(int argc, char **argv)
+{
+  for (int x = 1; x < argc; x++)
+  {
+    std::string Option = argv[x];
+    if (x + 1 >= argc) return false;
+    const char *Value = argv[++x];
+
+    if (Option == "--baud") Settings.Baud = atol(Value);
+    else if (Option == "--return-delay-us") Native_Servo.Return_Delay_us = atol(Value);
+    else if (Option == "--speed") Native_Servo.Speed = atol(Value);
+    else if (Option == "--start") Native_Servo.Start_Position = (int32_t)atol(Value);
+    else if (Option == "--link") Settings.Link = Value;
+    else return false;
+  }
+  return Settings.Baud >= 0 && Native_Servo.Return_Delay_us >= 0 && Native_Servo.Speed > 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (!Parse_Arguments(argc, argv))
+  {
+    Usage();
+    return 2;
+  }
+
+  Master_Fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (Master_Fd < 0 || grantpt(Master_Fd) != 0 || unlockpt(Master_Fd) != 0)
+  {
+    perror("posix_openpt");
+    return 2;
+  }
+  const char *Slave_Path = ptsname(Master_Fd);
+
+  // Keep the other end open ourselves, otherwise reads on the master fail every time the PC software closes it. Raw mode so the pty does not echo our replies back to us.
+  int Slave_Fd = open(Slave_Path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+  struct termios Raw;
+  if (Slave_Fd < 0 || tcgetattr(Slave_Fd, &Raw) != 0)
+  {
+    perror(Slave_Path);
+    return 2;
+  }
+  cfmakeraw(&Raw);
+  tcsetattr(Slave_Fd, TCSANOW, &Raw);
+
+  if (!Settings.Link.empty())
+  {
+    struct stat Existing;
+    if (lstat(Settings.Link.c_str(), &Existing) == 0)
+    {
+      if (!S_ISLNK(Existing.st_mode))
+      {
+        fprintf(stderr, "%s exists and is not a symlink, not replacing it\n", Settings.Link.c_str());
+        return 2;
+      }
+      unlink(Settings.Link.c_str());
+    }
+    if (symlink(Slave_Path, Settings.Link.c_str()) != 0)
+    {
+      perror(Settings.Link.c_str());
+      return 2;
+    }
+    atexit(Remove_Link);
+  }
+
+  printf("%s\n", Slave_Path);
+  fflush(stdout);
+
+  struct sigaction Action = {};
+  Action.sa_handler = Stop_Running;
+  sigaction(SIGINT, &Action, nullptr);
+  sigaction(SIGTERM, &Action, nullptr);
+
+  prctl(PR_SET_TIMERSLACK, 1); // Wake up on time, the default 50us slack is more than half a byte at 115200 baud
+
+  Boot_ns = Native_Now_ns();
+  Serial.Attach(Master_Fd, Settings.Baud);
+
+  setup();
+  while (Running)
+  {
+    // loop() polls PC_SERIAL.available() without ever blocking, like on the Teensy. When it did not take anything out of the receive buffer, nothing will change until the PC sends
+    // more, a byte finishes arriving or going out, or a millisecond passes (loop() also runs a millis() timer), so sleep until then instead of spinning.
+    uint64_t Reads = Serial.Reads();
+    loop();
+    if (Serial.Reads() == Reads)
+    {
+      Wait(Native_Now_ns() + 1000000ull, true);
+    }
+  }
+  return 0;
+}
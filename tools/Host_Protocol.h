@@ -0,0 +1,162 @@
+// ********************************************************************************************************************************************************************************************
+// Host side copy of the PC <-> Teensy serial protocol handled by Serial_Parse and Serial_Respond (include/Serial_Functions.h)
+// ********************************************************************************************************************************************************************************************
+
+// This is only used by the programs in the tools folder, which run on a Linux PC, not on the Teensy. Keep it in step with Serial_Functions.h if the protocol ever changes.
+//
+// Every command sent to the controller is exactly 8 bytes, starts with $ and ends with #
+//   $000000#              Discovery, the controller answers VM200G
+//   $123400#              Poll, the controller answers with a 12 byte status frame
+//   $DEBUG!#              Debug dump, several lines of text ending with "Current firmware is for Dynamixel <type>"
+//   $MOTOR?#              Motor type, answers "Dynamixel <type>"
+//   $ B1 B2 B3 B4 C % #   Goal position (B1 is the high byte), C is the Dynamixel style checksum, answers with a status frame
+//
+// The status frame is $ GOAL(4 bytes, high byte first) PRESENT(4 bytes, high byte first) MOVING ERROR #
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <termios.h>
+#include <unistd.h>
+
+const size_t  Command_Length = 8;                  // Number of bytes in every command, matches PC_Expected_Bytes in main.cpp
+const size_t  Status_Length = 12;                  // Number of bytes in the status frame written by Serial_Respond
+const char    Discovery_Command[] = "$000000#";    // Asks the controller to identify itself
+const char    Discovery_Reply[] = "VM200G";        // What the controller answers to the discovery command
+const char    Poll_Command[] = "$123400#";         // Asks the controller for a status frame without changing anything
+const char    Debug_Command[] = "$DEBUG!#";        // Asks the controller for the debug dump
+const char    Motor_Command[] = "$MOTOR?#";        // Asks the controller which kind of Dynamixel it was built for
+
+struct Status_Frame
+{
+  int32_t     Goal_Position;                       // The Dynamixel's goal position
+  int32_t     Present_Position;                    // The Dynamixel's present position
+  uint8_t     Moving;                              // 1 if the Dynamixel is moving
+  uint8_t     Error;                               // The Dynamixel's hardware error status
+};
+
+// ********************************************************************************************************************************************************************************************
+// Builds the 8 byte goal position command. Same checksum as Serial_Parse checks: the low byte of the inverted sum of the 4 position bytes.
+// ********************************************************************************************************************************************************************************************
+inline void Build_Goal_Command(int32_t Position, uint8_t *Command)
+{
+  uint32_t Raw = (uint32_t)Position;
+
+  Command[0] = '$';
+  Command[1] = (Raw >> 24) & 0xFF;
+  Command[2] = (Raw >> 16) & 0xFF;
+  Command[3] = (Raw >> 8) & 0xFF;
+  Command[4] = Raw & 0xFF;
+  Command[5] = (uint8_t)~(Command[1] + Command[2] + Command[3] + Command[4]);
+  Command[6] = '%';
+  Command[7] = '#';
+}
+
+// ********************************************************************************************************************************************************************************************
+// Decodes a 12 byte status frame. Returns false if the frame is not framed by $ and #, which usually means the stream is out of step.
+// ********************************************************************************************************************************************************************************************
+inline bool Parse_Status(const uint8_t *Frame, Status_Frame &Status)
+{
+  if (Frame[0] != '$' || Frame[Status_Length - 1] != '#')
+  {
+    return false;
+  }
+
+  Status.Goal_Position = (int32_t)(((uint32_t)Frame[1] << 24) | ((uint32_t)Frame[2] << 16) | ((uint32_t)Frame[3] << 8) | Frame[4]);
+  Status.Present_Position = (int32_t)(((uint32_t)Frame[5] << 24) | ((uint32_t)Frame[6] << 16) | ((uint32_t)Frame[7] << 8) | Frame[8]);
+  Status.Moving = Frame[9];
+  Status.Error = Frame[10];
+  return true;
+}
+
+// ********************************************************************************************************************************************************************************************
+// Time in microseconds that a number of bytes takes on the wire at a given baud rate (8N1, so 10 bits per byte). Useful as a floor when reading latency numbers.
+// ********************************************************************************************************************************************************************************************
+inline double Wire_Time_us(size_t Bytes, long Baud)
+{
+  return Baud > 0 ? (Bytes * 10.0 * 1000000.0) / Baud : 0.0;
+}
+
+// ********************************************************************************************************************************************************************************************
+// Turns a baud rate into the termios speed constant. Returns 0 if the rate is not one termios supports.
+// ********************************************************************************************************************************************************************************************
+inline speed_t Baud_To_Speed(long Baud)
+{
+  switch (Baud)
+  {
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+#ifdef B460800
+    case 460800:  return B460800;
+#endif
+#ifdef B921600
+    case 921600:  return B921600;
+#endif
+#ifdef B1000000
+    case 1000000: return B1000000;
+#endif
+#ifdef B2000000
+    case 2000000: return B2000000;
+#endif
+    default:      return 0;
+  }
+}
+
+// ********************************************************************************************************************************************************************************************
+// Opens a serial port (or pty) in raw 8N1 mode. The Teensy ignores the baud rate over USB, but a real UART or a simulator on a pty may not. Returns the file descriptor or -1.
+// The port is locked with flock() before anything is changed, so two programs never talk to the same controller. If somebody else has it, errno is EBUSY.
+// The lock goes away when the port is closed or the program dies, however it dies, so a crashed program never leaves a port locked.
+// ********************************************************************************************************************************************************************************************
+inline int Open_Port(const char *Path, long Baud, bool Non_Blocking)
+{
+  speed_t Speed = Baud_To_Speed(Baud);
+  if (Speed == 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  int Fd = open(Path, O_RDWR | O_NOCTTY | O_CLOEXEC | (Non_Blocking ? O_NONBLOCK : 0));
+  if (Fd < 0)
+  {
+    return -1;
+  }
+
+  // Not TIOCEXCL: it belongs to the tty rather than to us, so it stays set after we exit if anything else still has the tty open (a simulator holding the other side of a pty)
+  if (flock(Fd, LOCK_EX | LOCK_NB) != 0)
+  {
+    close(Fd);
+    errno = EBUSY;
+    return -1;
+  }
+
+  struct termios Settings;
+  if (tcgetattr(Fd, &Settings) != 0)
+  {
+    close(Fd);
+    return -1;
+  }
+  cfmakeraw(&Settings);
+  Settings.c_cflag |= CLOCAL | CREAD;
+  Settings.c_cc[VMIN] = 0;
+  Settings.c_cc[VTIME] = 0;
+  cfsetispeed(&Settings, Speed);
+  cfsetospeed(&Settings, Speed);
+  if (tcsetattr(Fd, TCSANOW, &Settings) != 0)
+  {
+    close(Fd);
+    return -1;
+  }
+
+  tcflush(Fd, TCIOFLUSH); // Throw away anything left over from before we opened the port
+  return Fd;
+}
@@ -0,0 +1,91 @@
+// ********************************************************************************************************************************************************************************************
+// Shared memory layout published by VM200_Daemon (tools/VM200_Daemon.cpp)
+// ********************************************************************************************************************************************************************************************
+
+// The daemon keeps the latest status of every controller in a POSIX shared memory object (default name /VM200_Daemon). Any program on the same PC can map it read only and
+// look at every controller at once without talking to the daemon or touching a serial port:
+//
+//   int Fd = shm_open("/VM200_Daemon", O_RDONLY, 0);
+//   const Snapshot_Table *Table = (const Snapshot_Table *)mmap(nullptr, sizeof(Snapshot_Table), PROT_READ, MAP_SHARED, Fd, 0);
+//   Port_Status Status;
+//   if (Read_Port_Status(Table->Ports[0], Status)) ...
+//
+// Each slot is protected by a sequence counter. The daemon makes it odd while it is writing and even when it is done, so a reader copies the slot and tries again if the counter
+// was odd or changed while it was copying. Nothing ever blocks the daemon.
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+const uint32_t  Snapshot_Magic = 0x564D3230;    // "VM20"
+const uint32_t  Snapshot_Version = 1;           // Bump when Port_Status or Snapshot_Table changes
+const size_t    Snapshot_Max_Ports = 256;       // Most controllers one daemon will look after
+const size_t    Snapshot_Path_Length = 64;      // Longest serial port path stored, including the null byte
+
+enum Port_State : uint32_t
+{
+  Port_Unused = 0,                              // Slot has never been used
+  Port_Discovering = 1,                         // Port is open and waiting for VM200G
+  Port_Online = 2,                              // Controller answered and is being polled
+  Port_Offline = 3,                             // Port is closed, busy or silent. The daemon keeps trying to find a controller on it.
+  Port_Ignored = 4                              // Port answered discovery with something other than VM200G. The daemon still tries again now and then.
+};
+
+struct Port_Status
+{
+  char          Path[Snapshot_Path_Length];     // Serial port, for example /dev/ttyACM0
+  uint32_t      State;                          // One of Port_State
+  int32_t       Goal_Position;                  // Last goal position reported by the controller
+  int32_t       Present_Position;               // Last present position reported by the controller
+  uint8_t       Moving;                         // 1 if the Dynamixel was moving
+  uint8_t       Error;                          // The Dynamixel's hardware error status
+  uint8_t       Reserved[2];
+  uint64_t      Updated_ns;                     // CLOCK_MONOTONIC time of the last status frame, 0 if there has never been one
+  uint64_t      Polls;                          // Status frames received since the daemon started
+  uint64_t      Timeouts;                       // Commands that got no answer in time
+};
+
+struct Port_Slot
+{
+  std::atomic<uint32_t> Sequence;               // Odd while the daemon is writing Status
+  Port_Status           Status;
+};
+
+struct Snapshot_Table
+{
+  uint32_t      Magic;                          // Snapshot_Magic once the daemon has set the table up
+  uint32_t      Version;                        // Snapshot_Version
+  uint32_t      Port_Count;                     // Number of slots in use, slots at and above this are Port_Unused
+  uint32_t      Daemon_Pid;                     // Process ID of the daemon
+  Port_Slot     Ports[Snapshot_Max_Ports];
+};
+
+// ********************************************************************************************************************************************************************************************
+// Writer side, only used by the daemon
+// ********************************************************************************************************************************************************************************************
+inline void Write_Port_Status(Port_Slot &Slot, const Port_Status &Status)
+{
+  uint32_t Sequence = Slot.Sequence.load(std::memory_order_relaxed);
+  Slot.Sequence.store(Sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(&Slot.Status, &Status, sizeof(Status));
+  Slot.Sequence.store(Sequence + 2, std::memory_order_release);
+}
+
+// ********************************************************************************************************************************************************************************************
+// Reader side. Returns false if the daemon kept rewriting the slot for the whole time we were trying, which should never really happen.
+// ********************************************************************************************************************************************************************************************
+inline bool Read_Port_Status(const Port_Slot &Slot, Port_Status &Status)
+{
+  for (int Attempt = 0; Attempt < 1000; Attempt++)
+  {
+    uint32_t Before = Slot.Sequence.load(std::memory_order_acquire);
+    if (Before & 1) continue;
+    memcpy(&Status, (const void *)&Slot.Status, sizeof(Status));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (Slot.Sequence.load(std::memory_order_relaxed) == Before) return true;
+  }
+  return false;
+}
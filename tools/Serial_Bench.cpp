@@ -0,0 +1,633 @@
+// Serial_Bench - Measures how fast a controller answers commands over its serial port
+// Runs on a Linux PC, not on the Teensy. Build with: g++ -O2 -std=c++17 -o Serial_Bench tools/Serial_Bench.cpp
+// Version Info : 1.0
+
+/*
+   What is this? Serial_Parse has no way of telling us how many commands per second it can handle, or how long the PC waits for an answer. This program sends scripted workloads to a
+   controller, times every command from the moment it is written until the full reply has been read back, and prints the results as JSON so they can be kept and compared later.
+
+   Workloads:
+     poll    Nothing but $123400# status polls. This is what most PC software does all day.
+     goal    A flood of goal position commands. By default it re-sends the goal the Dynamixel already has, so nothing moves and only the "goal unchanged" path of Serial_Parse is timed.
+             Use --goal-span to alternate between the current goal and current goal + span, which times the setGoalPosition path as well. THIS WILL MOVE THE MOTOR.
+     mixed   Mostly polls with some goals, discovery, $MOTOR?# and $DEBUG!# queries mixed in, in a fixed pseudo random order so that every run sends the same thing.
+
+   The port can be a real controller (/dev/ttyACM0), a USB to serial adapter, or the pty of tools/Controller_Sim.cpp, which runs the firmware itself on the PC. --baud only matters for
+   real UARTs and Controller_Sim, which models the line speed, the Teensy's USB serial ignores it. The minimum time a status poll could possibly take at that baud rate is reported as status_wire_floor_us.
+
+   Regression checking: pass a previous result with --baseline. If throughput drops by more than --max-throughput-drop percent, or the p99 latency rises by more than --max-p99-rise
+   percent, on any workload, the program exits with 1. The baseline must have been recorded with the same --baud, --depth, --count, --goal-span, --seed and motor type, otherwise
+   nothing is compared. Any communication failure, or a baseline that cannot be read or compared, exits with 2.
+
+   Example:
+     Serial_Bench --port /dev/ttyACM0 --count 5000 --output today.json --baseline last_release.json
+*/
+
+#include "Host_Protocol.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+
+// ********************************************************************************************************************************************************************************************
+// Settings, changed from the command line
+// ********************************************************************************************************************************************************************************************
+
+struct Bench_Settings
+{
+  std::string   Port;                                   // Serial port or pty to talk to
+  long          Baud = 115200;                          // Same as PC_SERIAL.begin() in main.cpp
+  long          Count = 2000;                           // Number of commands sent per workload
+  long          Depth = 1;                              // Number of commands allowed in flight at once. 1 measures pure command to reply latency.
+  long          Goal_Span = 0;                          // How far the goal workload moves the motor. 0 means it never moves.
+  long          Timeout_ms = 1000;                      // How long to wait for a reply before giving up
+  unsigned long Seed = 1;                               // Seed for the mixed workload order
+  std::string   Workloads = "poll,goal,mixed";          // Which workloads to run, in order
+  std::string   Output;                                 // Where to write the JSON results. Empty means stdout.
+  std::string   Baseline;                               // Previous JSON results to compare against. Empty means no comparison.
+  double        Max_Throughput_Drop = 10.0;             // Percent
+  double        Max_P99_Rise = 20.0;                    // Percent
+};
+
+enum Reply_Kind
+{
+  Reply_Status,                                         // 12 byte status frame (polls and goals)
+  Reply_Discovery,                                      // VM200G
+  Reply_Text                                            // $MOTOR?# and $DEBUG!#, both end with the motor name
+};
+
+struct Bench_Command
+{
+  uint8_t       Bytes[Command_Length];
+  Reply_Kind    Kind;
+};
+
+struct Workload_Result
+{
+  std::string   Name;
+  long          Commands = 0;
+  double        Elapsed_s = 0;
+  double        Commands_Per_Sec = 0;
+  double        P50_us = 0;
+  double        P99_us = 0;
+  double        Max_us = 0;
+};
+
+static uint64_t Now_ns()
+{
+  struct timespec Now;
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  return (uint64_t)Now.tv_sec * 1000000000ull + Now.tv_nsec;
+}
+
+static Bench_Command Make_Command(const char *Text, Reply_Kind Kind)
+{
+  Bench_Command Command;
+  memcpy(Command.Bytes, Text, Command_Length);
+  Command.Kind = Kind;
+  return Command;
+}
+
+static Bench_Command Make_Goal(int32_t Position)
+{
+  Bench_Command Command;
+  Build_Goal_Command(Position, Command.Bytes);
+  Command.Kind = Reply_Status;
+  return Command;
+}
+
+// ********************************************************************************************************************************************************************************************
+// The serial port, with a receive buffer that replies are cut out of
+// ********************************************************************************************************************************************************************************************
+
+class Bench_Port
+{
+public:
+  int           Fd = -1;
+  std::string   Rx;                                     // Bytes read but not yet matched to a command
+  std::string   Text_End;                               // What text replies end with, learned from $MOTOR?# (for example "Dynamixel Y")
+
+  bool Write_All(const uint8_t *Bytes, size_t Length)
+  {
+    while (Length > 0)
+    {
+      ssize_t Written = write(Fd, Bytes, Length);
+      if (Written < 0)
+      {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN)
+        {
+          struct pollfd Wait = { Fd, POLLOUT, 0 };
+          poll(&Wait, 1, 100);
+          continue;
+        }
+        return false;
+      }
+      Bytes += Written;
+      Length -= Written;
+    }
+    return true;
+  }
+
+  // Waits up to Timeout_ms for more bytes. Returns the number of bytes added to Rx, 0 on timeout, -1 on error.
+  long Read_Some(int Timeout_ms)
+  {
+    struct pollfd Wait = { Fd, POLLIN, 0 };
+    int Ready = poll(&Wait, 1, Timeout_ms);
+    if (Ready < 0) return errno == EINTR ? 0 : -1;
+    if (Ready == 0) return 0;
+    if (Wait.revents & (POLLERR | POLLHUP | POLLNVAL))
+    {
+      errno = EIO; // poll() does not set errno for these, so say what happened ourselves
+      return -1;
+    }
+
+    char Buffer[4096];
+    ssize_t Got = read(Fd, Buffer, sizeof(Buffer));
+    if (Got < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    Rx.append(Buffer, Got);
+    return Got;
+  }
+
+  // Checks whether the front of Rx holds a complete reply of the given kind. Returns its length, 0 if more bytes are needed, or -1 if Rx cannot be that reply.
+  long Match_Reply(Reply_Kind Kind) const
+  {
+    switch (Kind)
+    {
+      case Reply_Status:
+        if (Rx.empty()) return 0;
+        if (Rx[0] != '$') return -1;
+        if (Rx.size() < Status_Length) return 0;
+        return Rx[Status_Length - 1] == '#' ? (long)Status_Length : -1;
+
+      case Reply_Discovery:
+      {
+        size_t Length = strlen(Discovery_Reply);
+        size_t Have = std::min(Rx.size(), Length);
+        if (Rx.compare(0, Have, Discovery_Reply, Have) != 0) return -1;
+        return Have == Length ? (long)Length : 0;
+      }
+
+      case Reply_Text:
+      {
+        size_t End = Rx.find(Text_End);
+        if (End != std::string::npos) return (long)(End + Text_End.size());
+        return Rx.size() > 8192 ? -1 : 0; // The debug dump is well under 1kB, so this much text means something is wrong
+      }
+    }
+    return -1;
+  }
+};
+
+// ********************************************************************************************************************************************************************************************
+// Sends one command and waits for its reply, used for setup before the timed runs
+// ********************************************************************************************************************************************************************************************
+
+static bool Transact(Bench_Port &Port, const Bench_Command &Command, long Timeout_ms, std::string &Reply)
+{
+  if (!Port.Write_All(Command.Bytes, Command_Length)) return false;
+
+  uint64_t Deadline = Now_ns() + (uint64_t)Timeout_ms * 1000000ull;
+  while (true)
+  {
+    long Length = Port.Match_Reply(Command.Kind);
+    if (Length < 0) return false;
+    if (Length > 0)
+    {
+      Reply = Port.Rx.substr(0, Length);
+      Port.Rx.erase(0, Length);
+      return true;
+    }
+    uint64_t Now = Now_ns();
+    if (Now >= Deadline) return false;
+    if (Port.Read_Some((int)((Deadline - Now) / 1000000ull) + 1) < 0) return false;
+  }
+}
+
+// Reads everything the controller sends until it has been quiet for Quiet_ms. Used for the $MOTOR?# reply, before we know what text replies end with.
+static std::string Read_Until_Quiet(Bench_Port &Port, int Quiet_ms, long Timeout_ms)
+{
+  uint64_t Deadline = Now_ns() + (uint64_t)Timeout_ms * 1000000ull;
+  while (Now_ns() < Deadline)
+  {
+    long Got = Port.Read_Some(Quiet_ms);
+    if (Got < 0) break;
+    if (Got == 0 && !Port.Rx.empty()) break;
+  }
+  std::string Text = Port.Rx;
+  Port.Rx.clear();
+  return Text;
+}
+
+// ********************************************************************************************************************************************************************************************
+// Runs one workload. Keeps up to Depth commands in flight and times each one from write to the end of its reply.
+// ********************************************************************************************************************************************************************************************
+
+struct In_Flight
+{
+  Reply_Kind    Kind;
+  uint64_t      Sent_ns;
+};
+
+static double Percentile(const std::vector<double> &Sorted, double Fraction)
+{
+  if (Sorted.empty()) return 0;
+  size_t Rank = (size_t)(Fraction * Sorted.size() + 0.999999); // Nearest rank
+  if (Rank < 1) Rank = 1;
+  if (Rank > Sorted.size()) Rank = Sorted.size();
+  return Sorted[Rank - 1];
+}
+
+static bool Run_Workload(Bench_Port &Port, const Bench_Settings &Settings, const std::string &Name, const std::vector<Bench_Command> &Commands, Workload_Result &Result)
+{
+  std::deque<In_Flight> Pending;
+  std::vector<double>   Latency_us;
+  size_t                Next = 0;
+
+  Latency_us.reserve(Commands.size());
+  uint64_t Start = Now_ns();
+
+  while (Next < Commands.size() || !Pending.empty())
+  {
+    // Keep the pipe full
+    while (Next < Commands.size() && (long)Pending.size() < Settings.Depth)
+    {
+      uint64_t Sent = Now_ns();
+      if (!Port.Write_All(Commands[Next].Bytes, Command_Length))
+      {
+        fprintf(stderr, "%s: write failed on command %zu: %s\n", Name.c_str(), Next, strerror(errno));
+        return false;
+      }
+      Pending.push_back({ Commands[Next].Kind, Sent });
+      Next++;
+    }
+
+    // Match as many replies as are already buffered
+    while (!Pending.empty())
+    {
+      long Length = Port.Match_Reply(Pending.front().Kind);
+      if (Length < 0)
+      {
+        fprintf(stderr, "%s: unexpected reply after %zu commands (is the controller in a fault condition?)\n", Name.c_str(), Latency_us.size());
+        return false;
+      }
+      if (Length == 0) break;
+      Latency_us.push_back((Now_ns() - Pending.front().Sent_ns) / 1000.0);
+      Port.Rx.erase(0, Length);
+      Pending.pop_front();
+    }
+
+    if (Pending.empty()) continue;
+
+    long Got = Port.Read_Some((int)Settings.Timeout_ms);
+    if (Got < 0)
+    {
+      fprintf(stderr, "%s: read failed: %s\n", Name.c_str(), strerror(errno));
+      return false;
+    }
+    if (Got == 0 && Now_ns() - Pending.front().Sent_ns >= (uint64_t)Settings.Timeout_ms * 1000000ull)
+    {
+      fprintf(stderr, "%s: no reply within %ld ms after %zu commands\n", Name.c_str(), Settings.Timeout_ms, Latency_us.size());
+      return false;
+    }
+  }
+
+  Result.Name = Name;
+  Result.Commands = (long)Latency_us.size();
+  Result.Elapsed_s = (Now_ns() - Start) / 1e9;
+  Result.Commands_Per_Sec = Result.Elapsed_s > 0 ? Result.Commands / Result.Elapsed_s : 0;
+  std::sort(Latency_us.begin(), Latency_us.end());
+  Result.P50_us = Percentile(Latency_us, 0.50);
+  Result.P99_us = Percentile(Latency_us, 0.99);
+  Result.Max_us = Latency_us.empty() ? 0 : Latency_us.back();
+  return true;
+}
+
+// ********************************************************************************************************************************************************************************************
+// Workload scripts
+// ********************************************************************************************************************************************************************************************
+
+static std::vector<Bench_Command> Poll_Workload(long Count)
+{
+  return std::vector<Bench_Command>(Count, Make_Command(Poll_Command, Reply_Status));
+}
+
+static std::vector<Bench_Command> Goal_Workload(long Count, int32_t Base_Goal, long Span)
+{
+  std::vector<Bench_Command> Commands;
+  for (long x = 0; x < Count; x++)
+  {
+    Commands.push_back(Make_Goal(Base_Goal + ((x % 2) ? Span : 0)));
+  }
+  if (Span != 0)
+  {
+    Commands.push_back(Make_Goal(Base_Goal)); // Always finish where we started
+  }
+  return Commands;
+}
+
+static std::vector<Bench_Command> Mixed_Workload(long Count, int32_t Base_Goal, unsigned long Seed)
+{
+  std::vector<Bench_Command> Commands;
+  unsigned long State = Seed;
+  for (long x = 0; x < Count; x++)
+  {
+    State = State * 1103515245ul + 12345ul; // Plain LCG, we only need the same order every run
+    unsigned Pick = (State >> 16) % 100;
+    if (Pick < 85)      Commands.push_back(Make_Command(Poll_Command, Reply_Status));
+    else if (Pick < 95) Commands.push_back(Make_Goal(Base_Goal));
+    else if (Pick < 97) Commands.push_back(Make_Command(Discovery_Command, Reply_Discovery));
+    else if (Pick < 99) Commands.push_back(Make_Command(Motor_Command, Reply_Text));
+    else                Commands.push_back(Make_Command(Debug_Command, Reply_Text));
+  }
+  return Commands;
+}
+
+// ********************************************************************************************************************************************************************************************
+// JSON output and baseline comparison
+// ********************************************************************************************************************************************************************************************
+
+static std::string Json_String(const std::string &Text)
+{
+  std::string Out = "\"";
+  for (char c : Text)
+  {
+    if (c == '"' || c == '\\') { Out += '\\'; Out += c; }
+    else if ((unsigned char)c < 0x20) { char Escaped[8]; snprintf(Escaped, sizeof(Escaped), "\\u%04x", c); Out += Escaped; }
+    else Out += c;
+  }
+  return Out + "\"";
+}
+
+static std::string Results_Json(const Bench_Settings &Settings, const std::string &Motor, const std::vector<Workload_Result> &Results)
+{
+  std::ostringstream Out;
+  Out.setf(std::ios::fixed);
+  Out.precision(3);
+  Out << "{\n";
+  Out << "  \"tool\": \"Serial_Bench\",\n";
+  Out << "  \"port\": " << Json_String(Settings.Port) << ",\n";
+  Out << "  \"baud\": " << Settings.Baud << ",\n";
+  Out << "  \"depth\": " << Settings.Depth << ",\n";
+  Out << "  \"count\": " << Settings.Count << ",\n";
+  Out << "  \"goal_span\": " << Settings.Goal_Span << ",\n";
+  Out << "  \"seed\": " << Settings.Seed << ",\n";
+  Out << "  \"motor\": " << Json_String(Motor) << ",\n";
+  Out << "  \"status_wire_floor_us\": " << Wire_Time_us(Command_Length + Status_Length, Settings.Baud) << ",\n";
+  Out << "  \"workloads\": [\n";
+  for (size_t x = 0; x < Results.size(); x++)
+  {
+    const Workload_Result &R = Results[x];
+    Out << "    {\"name\": " << Json_String(R.Name)
+        << ", \"commands\": " << R.Commands
+        << ", \"elapsed_s\": " << R.Elapsed_s
+        << ", \"commands_per_sec\": " << R.Commands_Per_Sec
+        << ", \"p50_us\": " << R.P50_us
+        << ", \"p99_us\": " << R.P99_us
+        << ", \"max_us\": " << R.Max_us
+        << "}" << (x + 1 < Results.size() ? "," : "") << "\n";
+  }
+  Out << "  ]\n";
+  Out << "}\n";
+  return Out.str();
+}
+
+// Pulls a number out of one workload object in a file written by Results_Json. This is not a general JSON parser, it only has to read back what we wrote.
+static bool Baseline_Number(const std::string &Json, const std::string &Workload, const char *Key, double &Value)
+{
+  size_t Start = Json.find("\"name\": " + Json_String(Workload));
+  if (Start == std::string::npos) return false;
+  size_t End = Json.find('}', Start);
+  size_t At = Json.find(std::string("\"") + Key + "\":", Start);
+  if (At == std::string::npos || At > End) return false;
+  Value = strtod(Json.c_str() + At + strlen(Key) + 3, nullptr);
+  return true;
+}
+
+// Pulls one of the run settings written at the top of the file by Results_Json, as the raw text after the colon
+static bool Baseline_Setting(const std::string &Json, const char *Key, std::string &Value)
+{
+  std::string Label = std::string("\"") + Key + "\": ";
+  size_t At = Json.find(Label);
+  if (At == std::string::npos) return false;
+  At += Label.size();
+  size_t End = Json.find_first_of(",\n", At);
+  Value = Json.substr(At, End == std::string::npos ? std::string::npos : End - At);
+  return true;
+}
+
+enum Baseline_Result
+{
+  Baseline_Passed,                                      // Nothing got worse than the thresholds allow
+  Baseline_Regressed,                                   // At least one workload got too slow
+  Baseline_Unusable                                     // Baseline could not be read or was recorded with different settings
+};
+
+static Baseline_Result Check_Baseline(const Bench_Settings &Settings, const std::string &Motor, const std::vector<Workload_Result> &Results)
+{
+  std::ifstream File(Settings.Baseline);
+  if (!File)
+  {
+    fprintf(stderr, "Could not read baseline %s\n", Settings.Baseline.c_str());
+    return Baseline_Unusable;
+  }
+  std::stringstream Buffer;
+  Buffer << File.rdbuf();
+  std::string Json = Buffer.str();
+
+  // Numbers are only comparable if both runs sent the same commands, the same way, over the same line to the same firmware build
+  const std::pair<const char *, std::string> Must_Match[] =
+  {
+    { "baud", std::to_string(Settings.Baud) },
+    { "depth", std::to_string(Settings.Depth) },
+    { "count", std::to_string(Settings.Count) },
+    { "goal_span", std::to_string(Settings.Goal_Span) },
+    { "seed", std::to_string(Settings.Seed) },
+    { "motor", Json_String(Motor) }
+  };
+  for (const auto &Setting : Must_Match)
+  {
+    std::string Recorded;
+    if (!Baseline_Setting(Json, Setting.first, Recorded))
+    {
+      fprintf(stderr, "Baseline %s does not record %s, cannot compare\n", Settings.Baseline.c_str(), Setting.first);
+      return Baseline_Unusable;
+    }
+    if (Recorded != Setting.second)
+    {
+      fprintf(stderr, "Baseline %s was recorded with %s %s, this run uses %s, cannot compare\n", Settings.Baseline.c_str(), Setting.first, Recorded.c_str(), Setting.second.c_str());
+      return Baseline_Unusable;
+    }
+  }
+
+  bool Passed = true;
+  for (const Workload_Result &R : Results)
+  {
+    double Old_Rate, Old_P99;
+    if (!Baseline_Number(Json, R.Name, "commands_per_sec", Old_Rate) || !Baseline_Number(Json, R.Name, "p99_us", Old_P99))
+    {
+      fprintf(stderr, "%-6s not in baseline, skipped\n", R.Name.c_str());
+      continue;
+    }
+
+    double Rate_Change = Old_Rate > 0 ? (R.Commands_Per_Sec - Old_Rate) * 100.0 / Old_Rate : 0;
+    double P99_Change = Old_P99 > 0 ? (R.P99_us - Old_P99) * 100.0 / Old_P99 : 0;
+    bool   Rate_Ok = -Rate_Change <= Settings.Max_Throughput_Drop;
+    bool   P99_Ok = P99_Change <= Settings.Max_P99_Rise;
+
+    fprintf(stderr, "%-6s %10.1f cmd/s (%+6.1f%%) %s   p99 %10.1f us (%+6.1f%%) %s\n", R.Name.c_str(),
+            R.Commands_Per_Sec, Rate_Change, Rate_Ok ? "ok  " : "SLOW",
+            R.P99_us, P99_Change, P99_Ok ? "ok" : "SLOW");
+    Passed = Passed && Rate_Ok && P99_Ok;
+  }
+  return Passed ? Baseline_Passed : Baseline_Regressed;
+}
+
+// ********************************************************************************************************************************************************************************************
+// Command line
+// ********************************************************************************************************************************************************************************************
+
+static void Usage()
+{
+  fprintf(stderr,
+    "Usage: Serial_Bench --port PATH [options]\n"
+    "  --baud N                   Line speed (default 115200)\n"
+    "  --count N                  Commands per workload (default 2000)\n"
+    "  --depth N                  Commands in flight at once (default 1)\n"
+    "  --workloads LIST           Comma separated from poll,goal,mixed (default all three)\n"
+    "  --goal-span N              Goal workload moves the motor by N counts (default 0, no movement)\n"
+    "  --timeout-ms N             Reply timeout (default 1000)\n"
+    "  --seed N                   Mixed workload order (default 1)\n"
+    "  --output FILE              Write JSON results to FILE instead of stdout\n"
+    "  --baseline FILE            Compare with earlier results, exit 1 on regression\n"
+    "  --max-throughput-drop PCT  Allowed throughput drop (default 10)\n"
+    "  --max-p99-rise PCT         Allowed p99 latency rise (default 20)\n");
+}
+
+static bool Parse_Arguments(int argc, char **argv, Bench_Settings &Settings)
+{
+  for (int x = 1; x < argc; x++)
+  {
+    std::string Option = argv[x];
+    if (x + 1 >= argc) return false;
+    const char *Value = argv[++x];
+
+    if (Option == "--port") Settings.Port = Value;
+    else if (Option == "--baud") Settings.Baud = atol(Value);
+    else if (Option == "--count") Settings.Count = atol(Value);
+    else if (Option == "--depth") Settings.Depth = atol(Value);
+    else if (Option == "--workloads") Settings.Workloads = Value;
+    else if (Option == "--goal-span") Settings.Goal_Span = atol(Value);
+    else if (Option == "--timeout-ms") Settings.Timeout_ms = atol(Value);
+    else if (Option == "--seed") Settings.Seed = strtoul(Value, nullptr, 10);
+    else if (Option == "--output") Settings.Output = Value;
+    else if (Option == "--baseline") Settings.Baseline = Value;
+    else if (Option == "--max-throughput-drop") Settings.Max_Throughput_Drop = atof(Value);
+    else if (Option == "--max-p99-rise") Settings.Max_P99_Rise = atof(Value);
+    else return false;
+  }
+  if (Baud_To_Speed(Settings.Baud) == 0)
+  {
+    fprintf(stderr, "Unsupported baud rate %ld\n", Settings.Baud);
+    return false;
+  }
+  return !Settings.Port.empty() && Settings.Count > 0 && Settings.Depth > 0 && Settings.Timeout_ms > 0;
+}
+
+int main(int argc, char **argv)
+{
+  Bench_Settings Settings;
+  if (!Parse_Arguments(argc, argv, Settings))
+  {
+    Usage();
+    return 2;
+  }
+
+  Bench_Port Port;
+  Port.Fd = Open_Port(Settings.Port.c_str(), Settings.Baud, true);
+  if (Port.Fd < 0)
+  {
+    fprintf(stderr, "Could not open %s at %ld baud: %s\n", Settings.Port.c_str(), Settings.Baud, strerror(errno));
+    return 2;
+  }
+
+  // Find out what the controller was built for. Text replies have no terminator, so the motor name tells us where they end.
+  Bench_Command Motor = Make_Command(Motor_Command, Reply_Text);
+  if (!Port.Write_All(Motor.Bytes, Command_Length))
+  {
+    fprintf(stderr, "Could not write to %s\n", Settings.Port.c_str());
+    return 2;
+  }
+  Port.Text_End = Read_Until_Quiet(Port, 100, Settings.Timeout_ms);
+  if (Port.Text_End.compare(0, 10, "Dynamixel ") != 0)
+  {
+    fprintf(stderr, "%s did not answer $MOTOR?# like a controller (got %zu bytes)\n", Settings.Port.c_str(), Port.Text_End.size());
+    return 2;
+  }
+
+  // Read the current goal so the goal workloads start from wherever the motor already is
+  std::string Reply;
+  Status_Frame Status;
+  if (!Transact(Port, Make_Command(Poll_Command, Reply_Status), Settings.Timeout_ms, Reply) || !Parse_Status((const uint8_t *)Reply.data(), Status))
+  {
+    fprintf(stderr, "%s did not answer the first status poll\n", Settings.Port.c_str());
+    return 2;
+  }
+
+  std::vector<Workload_Result> Results;
+  std::stringstream Names(Settings.Workloads);
+  std::string Name;
+  while (std::getline(Names, Name, ','))
+  {
+    std::vector<Bench_Command> Commands;
+    if (Name == "poll") Commands = Poll_Workload(Settings.Count);
+    else if (Name == "goal") Commands = Goal_Workload(Settings.Count, Status.Goal_Position, Settings.Goal_Span);
+    else if (Name == "mixed") Commands = Mixed_Workload(Settings.Count, Status.Goal_Position, Settings.Seed);
+    else
+    {
+      fprintf(stderr, "Unknown workload %s\n", Name.c_str());
+      return 2;
+    }
+
+    Workload_Result Result;
+    if (!Run_Workload(Port, Settings, Name, Commands, Result))
+    {
+      return 2;
+    }
+    Results.push_back(Result);
+  }
+  close(Port.Fd);
+
+  std::string Json = Results_Json(Settings, Port.Text_End, Results);
+  if (Settings.Output.empty())
+  {
+    fputs(Json.c_str(), stdout);
+  }
+  else
+  {
+    std::ofstream File(Settings.Output);
+    File << Json;
+    if (!File)
+    {
+      fprintf(stderr, "Could not write %s\n", Settings.Output.c_str());
+      return 2;
+    }
+  }
+
+  if (!Settings.Baseline.empty())
+  {
+    Baseline_Result Compared = Check_Baseline(Settings, Port.Text_End, Results);
+    if (Compared == Baseline_Unusable) return 2;
+    if (Compared == Baseline_Regressed) return 1;
+  }
+  return 0;
+}
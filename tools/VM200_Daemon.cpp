@@ -0,0 +1,945 @@
+// VM200_Daemon - Owns every controller on a PC and shares their status with any number of local programs
+// Runs on a Linux PC, not on the Teensy. Build with: g++ -O2 -std=c++17 -o VM200_Daemon tools/VM200_Daemon.cpp -lrt
+// Version Info : 1.0
+
+/*
+   What is this? When dozens of controllers are plugged into one PC, every program that opens the ports itself ends up polling them one after another, and two programs cannot share
+   a port. This daemon opens every port once, finds the controllers by sending $000000# to all of them at the same time, and then keeps one poll in flight on every controller at
+   once using epoll. A slow or missing controller never holds up the others, so the refresh rate of the whole fleet is limited by the slowest single controller, not by the sum of them.
+
+   Status goes out two ways:
+     1. A POSIX shared memory table (layout in tools/Host_Snapshot.h). Readers map it and read any controller's latest status without asking anybody.
+     2. A Unix stream socket with a simple line based text protocol, for programs that want to be told about changes or send goal positions:
+          LIST                  Answers "PORT <index> <path> <state>" for every port, then "END"
+          SUB                   Start receiving "STATUS <index> <goal> <present> <moving> <error>" for every new status frame and "STATE <index> <state>" when a port changes state
+          UNSUB                 Stop receiving them
+          GOAL <index> <pos>    Send a goal position to a controller. Answers "OK GOAL <index> <pos>" once the controller has answered the goal command, or
+                                "ERR GOAL <index> <reason>" if it never will (controller went offline, or a newer goal replaced it before it was sent)
+          SHM                   Answers "SHM <name>" with the shared memory object name
+        Every status frame that arrives in one pass of the loop is sent to each client in a single write.
+
+   Scheduling: every online controller has exactly one command in flight, because Serial_Parse answers one command at a time. When a reply arrives the next command goes out once
+   --interval-ms has passed since the last one. Goal positions from clients are not sent straight away, they replace the next poll (a goal command also answers with a status frame),
+   and if several goals arrive for the same controller before then, only the newest one is sent. A goal stays pending until a status frame answers it, so a goal command that
+   times out is sent again. After any timeout the line has to be quiet for --timeout-ms before the next command, so a late frame from the old command is not taken as the reply to
+   the new one.
+
+   Ownership: every port is locked with flock(), so no other program (or second daemon) can talk to a controller while the daemon has it. The shared memory object
+   is locked too, and the socket is only replaced if nothing is listening on it, so starting a second daemon with the same names fails instead of taking over the first one.
+
+   Controllers that stop answering are closed after --max-missed timeouts in a row and discovery is tried again every --retry-ms. Ports that have never answered discovery (busy,
+   silent, still in setup(), or answering something other than VM200G) are tried again too, starting at --retry-ms and doubling each time up to --max-retry-ms, so a controller is
+   never locked out until the daemon restarts. New ports that match the --ports patterns are picked up every --rescan-ms.
+
+   Example:
+     VM200_Daemon --ports '/dev/ttyACM*' --ports '/dev/ttyUSB*' --interval-ms 5
+*/
+
+#include "Host_Protocol.h"
+#include "Host_Snapshot.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <glob.h>
+#include <sys/file.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// ********************************************************************************************************************************************************************************************
+// Settings, changed from the command line
+// ********************************************************************************************************************************************************************************************
+
+struct Daemon_Settings
+{
+  std::vector<std::string> Patterns;                    // Glob patterns of serial ports to look at
+  long          Baud = 115200;                          // Same as PC_SERIAL.begin() in main.cpp
+  long          Interval_ms = 10;                       // Shortest time between two commands to the same controller. 0 means as fast as it answers.
+  long          Timeout_ms = 250;                       // How long to wait for a status frame
+  long          Discovery_Timeout_ms = 1000;            // How long to wait for VM200G. Longer because a Teensy that has just been plugged in may still be in setup()
+  long          Max_Missed = 5;                         // Timeouts in a row before a controller is considered gone
+  long          Retry_ms = 2000;                        // How often to look for a controller that has gone away
+  long          Max_Retry_ms = 60000;                   // Longest wait between discovery attempts on a port that has never answered
+  long          Rescan_ms = 5000;                       // How often to look for new ports
+  std::string   Socket_Path = "/tmp/VM200_Daemon.sock"; // Unix socket clients connect to
+  std::string   Shm_Name = "/VM200_Daemon";             // Shared memory object name
+};
+
+const size_t    Client_Tx_Limit = 1 << 20;              // A client that falls this far behind is disconnected rather than letting it use up memory
+const size_t    Client_Rx_Limit = 4096;                 // Longest command line a client may send
+
+// ********************************************************************************************************************************************************************************************
+// Controllers and clients
+// ********************************************************************************************************************************************************************************************
+
+struct Controller
+{
+  Port_Status   Status = {};                            // What gets published, State lives in here too
+  int           Fd = -1;
+  std::string   Rx;                                     // Bytes read but not yet used
+  std::string   Tx;                                     // Bytes the port would not take yet
+  bool          Awaiting = false;                       // A command is in flight
+  bool          Was_Online = false;                     // Has answered discovery at least once, so it is retried at full speed
+  long          Retry_Delay_ms = 0;                     // Wait before the next discovery attempt, grows for ports that have never answered
+  uint64_t      Sent_ns = 0;                            // When the command in flight was sent
+  uint64_t      Next_ns = 0;                            // When the next command may be sent (online) or the next retry is due (offline)
+  long          Missed = 0;                             // Timeouts in a row
+  bool          Goal_Pending = false;                   // A client asked for a goal that has not been sent yet
+  int32_t       Goal = 0;                               // The newest goal asked for
+  std::vector<int> Goal_Waiters;                        // Clients to answer when the pending goal is done
+  bool          Goal_In_Flight = false;                 // The command in flight is a goal
+  int32_t       In_Flight_Goal = 0;                     // The goal in flight
+  std::vector<int> In_Flight_Waiters;                   // Clients to answer when the goal in flight is answered
+  bool          Draining = false;                       // A command timed out, waiting for the line to go quiet before sending another
+  uint64_t      Quiet_Since_ns = 0;                     // When the last byte arrived while draining
+};
+
+struct Client
+{
+  int           Fd = -1;
+  std::string   Rx;
+  std::string   Tx;
+  bool          Subscribed = false;
+};
+
+// Every file descriptor in epoll carries what it is and which one in its data field
+enum Event_Source : uint32_t
+{
+  Source_Signal = 1,
+  Source_Listener = 2,
+  Source_Controller = 3,
+  Source_Client = 4
+};
+
+static uint64_t Event_Tag(Event_Source Source, uint32_t Id)
+{
+  return ((uint64_t)Source << 32) | Id;
+}
+
+static uint64_t Now_ns()
+{
+  struct timespec Now;
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  return (uint64_t)Now.tv_sec * 1000000000ull + Now.tv_nsec;
+}
+
+static const char *State_Name(uint32_t State)
+{
+  switch (State)
+  {
+    case Port_Discovering: return "discovering";
+    case Port_Online:      return "online";
+    case Port_Offline:     return "offline";
+    case Port_Ignored:     return "ignored";
+    default:               return "unused";
+  }
+}
+
+// Reads a whole token as a number between Low and High. Anything else is refused rather than cut short or wrapped, "5000abc" and 4294967296 included.
+static bool Parse_Number(const char *Text, long Low, long High, long &Value)
+{
+  char *End;
+  errno = 0;
+  long Parsed = strtol(Text, &End, 10);
+  if (End == Text || *End != '\0' || errno == ERANGE || Parsed < Low || Parsed > High)
+  {
+    return false;
+  }
+  Value = Parsed;
+  return true;
+}
+
+// ********************************************************************************************************************************************************************************************
+// The daemon itself
+// ********************************************************************************************************************************************************************************************
+
+class Daemon
+{
+public:
+  explicit Daemon(const Daemon_Settings &Settings) : Settings(Settings) {}
+
+  bool Start();
+  void Run();
+  void Stop();
+
+private:
+  const Daemon_Settings   &Settings;
+  int                     Epoll_Fd = -1;
+  int                     Signal_Fd = -1;
+  int                     Listen_Fd = -1;
+  int                     Shm_Fd = -1;
+  Snapshot_Table          *Table = nullptr;
+  bool                    Owns_Shm = false;             // We hold the lock on the shared memory, so it is ours to remove
+  bool                    Owns_Socket = false;          // We bound the socket path, so it is ours to remove
+  std::vector<Controller> Controllers;                  // Index in here is the index clients and the shared memory table use
+  std::map<int, Client>   Clients;                      // By file descriptor
+  uint64_t                Next_Rescan_ns = 0;
+  bool                    Running = true;
+
+  void Rescan_Ports(uint64_t Now);
+  void Open_Controller(uint32_t Index, uint64_t Now);
+  void Close_Controller(uint32_t Index);
+  void Retry_Later(uint32_t Index, uint64_t Now, uint32_t State);
+  void Answer_Goal_Waiters(std::vector<int> &Waiters, const std::string &Line);
+  void Requeue_Goal(uint32_t Index);
+  void Set_State(uint32_t Index, uint32_t State);
+  void Send_Command(uint32_t Index, const uint8_t *Command, uint64_t Now);
+  void Flush_Controller(uint32_t Index);
+  void Read_Controller(uint32_t Index, uint64_t Now, bool Hung_Up);
+  void Service_Controller(uint32_t Index, uint64_t Now);
+  int  Next_Timeout_ms(uint64_t Now) const;
+
+  void Accept_Clients();
+  void Read_Client(int Fd);
+  void Handle_Client_Line(Client &Who, const std::string &Line);
+  void Flush_Client(int Fd);
+  void Drop_Client(int Fd);
+  void Broadcast(const std::string &Line);
+
+  void Publish(uint32_t Index);
+};
+
+// ********************************************************************************************************************************************************************************************
+// Setup and teardown
+// ********************************************************************************************************************************************************************************************
+
+bool Daemon::Start()
+{
+  Epoll_Fd = epoll_create1(EPOLL_CLOEXEC);
+  if (Epoll_Fd < 0)
+  {
+    perror("epoll_create1");
+    return false;
+  }
+
+  // Handle SIGINT and SIGTERM in the loop instead of in a signal handler, so we can always clean up the socket and shared memory
+  sigset_t Signals;
+  sigemptyset(&Signals);
+  sigaddset(&Signals, SIGINT);
+  sigaddset(&Signals, SIGTERM);
+  sigprocmask(SIG_BLOCK, &Signals, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+  Signal_Fd = signalfd(-1, &Signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  struct epoll_event Event = {};
+  Event.events = EPOLLIN;
+  Event.data.u64 = Event_Tag(Source_Signal, 0);
+  epoll_ctl(Epoll_Fd, EPOLL_CTL_ADD, Signal_Fd, &Event);
+
+  // Shared memory table. The lock on it is what says which daemon is running, it goes away by itself if a daemon dies, so a table left behind by a crash can be reused.
+  Shm_Fd = shm_open(Settings.Shm_Name.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+  if (Shm_Fd < 0)
+  {
+    fprintf(stderr, "Could not create shared memory %s: %s\n", Settings.Shm_Name.c_str(), strerror(errno));
+    return false;
+  }
+  if (flock(Shm_Fd, LOCK_EX | LOCK_NB) != 0)
+  {
+    fprintf(stderr, "Another daemon is already using shared memory %s\n", Settings.Shm_Name.c_str());
+    return false;
+  }
+  Owns_Shm = true;
+  if (ftruncate(Shm_Fd, sizeof(Snapshot_Table)) != 0)
+  {
+    fprintf(stderr, "Could not size shared memory %s: %s\n", Settings.Shm_Name.c_str(), strerror(errno));
+    return false;
+  }
+  void *Mapping = mmap(nullptr, sizeof(Snapshot_Table), PROT_READ | PROT_WRITE, MAP_SHARED, Shm_Fd, 0);
+  if (Mapping == MAP_FAILED)
+  {
+    perror("mmap");
+    return false;
+  }
+  memset(Mapping, 0, sizeof(Snapshot_Table));
+  Table = (Snapshot_Table *)Mapping;
+  Table->Version = Snapshot_Version;
+  Table->Daemon_Pid = (uint32_t)getpid();
+  std::atomic_thread_fence(std::memory_order_release);
+  Table->Magic = Snapshot_Magic; // Written last so readers know the table is ready
+
+  // Client socket
+  struct sockaddr_un Address = {};
+  Address.sun_family = AF_UNIX;
+  if (Settings.Socket_Path.size() >= sizeof(Address.sun_path))
+  {
+    fprintf(stderr, "Socket path %s is too long\n", Settings.Socket_Path.c_str());
+    return false;
+  }
+  strcpy(Address.sun_path, Settings.Socket_Path.c_str());
+
+  // Only remove a socket file that nobody is listening on any more, never a live one
+  int Probe_Fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (Probe_Fd >= 0 && connect(Probe_Fd, (struct sockaddr *)&Address, sizeof(Address)) == 0)
+  {
+    close(Probe_Fd);
+    fprintf(stderr, "Something is already listening on %s\n", Settings.Socket_Path.c_str());
+    return false;
+  }
+  if (Probe_Fd >= 0) close(Probe_Fd);
+  if (errno == ECONNREFUSED) unlink(Settings.Socket_Path.c_str()); // Left over from a daemon that did not shut down cleanly
+
+  Listen_Fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (Listen_Fd < 0 || bind(Listen_Fd, (struct sockaddr *)&Address, sizeof(Address)) != 0)
+  {
+    fprintf(stderr, "Could not bind %s: %s\n", Settings.Socket_Path.c_str(), strerror(errno));
+    return false;
+  }
+  Owns_Socket = true;
+  if (listen(Listen_Fd, 64) != 0)
+  {
+    fprintf(stderr, "Could not listen on %s: %s\n", Settings.Socket_Path.c_str(), strerror(errno));
+    return false;
+  }
+  Event.events = EPOLLIN;
+  Event.data.u64 = Event_Tag(Source_Listener, 0);
+  epoll_ctl(Epoll_Fd, EPOLL_CTL_ADD, Listen_Fd, &Event);
+
+  // Open every port and send discovery to all of them at once
+  Rescan_Ports(Now_ns());
+  return true;
+}
+
+void Daemon::Stop()
+{
+  for (uint32_t x = 0; x < Controllers.size(); x++) Close_Controller(x);
+  while (!Clients.empty()) Drop_Client(Clients.begin()->first);
+  if (Listen_Fd >= 0) close(Listen_Fd);
+  if (Owns_Socket) unlink(Settings.Socket_Path.c_str());
+  if (Table != nullptr) munmap(Table, sizeof(Snapshot_Table));
+  if (Owns_Shm) shm_unlink(Settings.Shm_Name.c_str()); // Unlinked while we still hold the lock, so a new daemon cannot pick up the old object in between
+  if (Shm_Fd >= 0) close(Shm_Fd);
+  if (Signal_Fd >= 0) close(Signal_Fd);
+  if (Epoll_Fd >= 0) close(Epoll_Fd);
+}
+
+// ********************************************************************************************************************************************************************************************
+// Main loop
+// ********************************************************************************************************************************************************************************************
+
+void Daemon::Run()
+{
+  struct epoll_event Events[64];
+
+  while (Running)
+  {
+    int Ready = epoll_wait(Epoll_Fd, Events, 64, Next_Timeout_ms(Now_ns()));
+    if (Ready < 0 && errno != EINTR)
+    {
+      perror("epoll_wait");
+      break;
+    }
+    uint64_t Now = Now_ns();
+
+    for (int x = 0; x < Ready; x++)
+    {
+      Event_Source Source = (Event_Source)(Events[x].data.u64 >> 32);
+      uint32_t     Id = (uint32_t)Events[x].data.u64;
+
+      if (Source == Source_Signal)
+      {
+        Running = false;
+      }
+      else if (Source == Source_Listener)
+      {
+        Accept_Clients();
+      }
+      else if (Source == Source_Controller)
+      {
+        if (Controllers[Id].Fd < 0) continue; // Closed earlier in this pass
+        if (Events[x].events & EPOLLOUT) Flush_Controller(Id);
+        if (Events[x].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) Read_Controller(Id, Now, (Events[x].events & (EPOLLERR | EPOLLHUP)) != 0);
+      }
+      else if (Source == Source_Client)
+      {
+        if (Clients.count((int)Id) == 0) continue;
+        if (Events[x].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) Read_Client((int)Id);
+        if (Clients.count((int)Id) != 0 && (Events[x].events & EPOLLOUT)) Flush_Client((int)Id);
+      }
+    }
+
+    // Timeouts, retries and sending the next command to every controller that is ready for one
+    Now = Now_ns();
+    for (uint32_t x = 0; x < Controllers.size(); x++) Service_Controller(x, Now);
+    if (Now >= Next_Rescan_ns) Rescan_Ports(Now);
+
+    // Everything published during this pass goes out to each client in one write
+    std::vector<int> Pending;
+    for (auto &Entry : Clients) if (!Entry.second.Tx.empty()) Pending.push_back(Entry.first);
+    for (int Fd : Pending) Flush_Client(Fd);
+  }
+}
+
+// How long epoll_wait may sleep before a controller needs attention
+int Daemon::Next_Timeout_ms(uint64_t Now) const
+{
+  uint64_t Earliest = Next_Rescan_ns;
+  for (const Controller &C : Controllers)
+  {
+    uint64_t Due;
+    if (C.Awaiting)
+    {
+      long Timeout = C.Status.State == Port_Discovering ? Settings.Discovery_Timeout_ms : Settings.Timeout_ms;
+      Due = C.Sent_ns + (uint64_t)Timeout * 1000000ull;
+    }
+    else if (C.Draining)
+    {
+      Due = C.Quiet_Since_ns + (uint64_t)Settings.Timeout_ms * 1000000ull;
+    }
+    else
+    {
+      Due = C.Next_ns;
+    }
+    if (Due < Earliest) Earliest = Due;
+  }
+  if (Earliest <= Now) return 0;
+  return (int)((Earliest - Now + 999999ull) / 1000000ull);
+}
+
+// ********************************************************************************************************************************************************************************************
+// Controllers
+// ********************************************************************************************************************************************************************************************
+
+void Daemon::Rescan_Ports(uint64_t Now)
+{
+  Next_Rescan_ns = Now + (uint64_t)Settings.Rescan_ms * 1000000ull;
+
+  for (const std::string &Pattern : Settings.Patterns)
+  {
+    glob_t Found;
+    if (glob(Pattern.c_str(), 0, nullptr, &Found) != 0) continue;
+
+    for (size_t x = 0; x < Found.gl_pathc; x++)
+    {
+      const char *Path = Found.gl_pathv[x];
+      bool Known = false;
+      for (const Controller &C : Controllers) Known = Known || strcmp(C.Status.Path, Path) == 0;
+      if (Known) continue;
+
+      if (Controllers.size() >= Snapshot_Max_Ports || strlen(Path) >= Snapshot_Path_Length)
+      {
+        fprintf(stderr, "Skipping %s, too many ports or path too long\n", Path);
+        continue;
+      }
+
+      Controller C;
+      strcpy(C.Status.Path, Path);
+      C.Retry_Delay_ms = Settings.Retry_ms;
+      Controllers.push_back(C);
+      Open_Controller((uint32_t)Controllers.size() - 1, Now);
+    }
+    globfree(&Found);
+  }
+  Table->Port_Count = (uint32_t)Controllers.size();
+}
+
+void Daemon::Open_Controller(uint32_t Index, uint64_t Now)
+{
+  Controller &C = Controllers[Index];
+
+  C.Fd = Open_Port(C.Status.Path, Settings.Baud, true);
+  if (C.Fd < 0)
+  {
+    // Not plugged back in yet, or busy with another program for now. Either way try again later.
+    Retry_Later(Index, Now, Port_Offline);
+    return;
+  }
+
+  struct epoll_event Event = {};
+  Event.events = EPOLLIN;
+  Event.data.u64 = Event_Tag(Source_Controller, Index);
+  epoll_ctl(Epoll_Fd, EPOLL_CTL_ADD, C.Fd, &Event);
+
+  C.Rx.clear();
+  C.Tx.clear();
+  C.Missed = 0;
+  Set_State(Index, Port_Discovering);
+  Send_Command(Index, (const uint8_t *)Discovery_Command, Now);
+}
+
+void Daemon::Close_Controller(uint32_t Index)
+{
+  Controller &C = Controllers[Index];
+  if (C.Fd < 0) return;
+  epoll_ctl(Epoll_Fd, EPOLL_CTL_DEL, C.Fd, nullptr);
+  close(C.Fd);
+  C.Fd = -1;
+  C.Awaiting = false;
+}
+
+// Closes the port and schedules the next discovery attempt. Ports that have been online come back at --retry-ms, the rest back off up to --max-retry-ms.
+void Daemon::Retry_Later(uint32_t Index, uint64_t Now, uint32_t State)
+{
+  Controller &C = Controllers[Index];
+  Close_Controller(Index);
+  C.Draining = false;
+  Answer_Goal_Waiters(C.In_Flight_Waiters, "ERR GOAL " + std::to_string(Index) + " controller offline\n");
+  Answer_Goal_Waiters(C.Goal_Waiters, "ERR GOAL " + std::to_string(Index) + " controller offline\n");
+  C.Goal_In_Flight = false;
+  C.Goal_Pending = false;
+  C.Next_ns = Now + (uint64_t)C.Retry_Delay_ms * 1000000ull;
+  if (!C.Was_Online) C.Retry_Delay_ms = std::min(C.Retry_Delay_ms * 2, Settings.Max_Retry_ms);
+  Set_State(Index, State);
+}
+
+// Sends a line to every client in the list that is still connected, and empties the list
+void Daemon::Answer_Goal_Waiters(std::vector<int> &Waiters, const std::string &Line)
+{
+  for (int Fd : Waiters)
+  {
+    auto Found = Clients.find(Fd);
+    if (Found != Clients.end()) Found->second.Tx += Line;
+  }
+  Waiters.clear();
+}
+
+// The goal in flight got no answer. Send it again, unless a client has asked for a newer one since.
+void Daemon::Requeue_Goal(uint32_t Index)
+{
+  Controller &C = Controllers[Index];
+  if (!C.Goal_In_Flight) return;
+  C.Goal_In_Flight = false;
+
+  if (C.Goal_Pending)
+  {
+    Answer_Goal_Waiters(C.In_Flight_Waiters, "ERR GOAL " + std::to_string(Index) + " replaced by a newer goal\n");
+    return;
+  }
+  C.Goal_Pending = true;
+  C.Goal = C.In_Flight_Goal;
+  C.Goal_Waiters.swap(C.In_Flight_Waiters);
+}
+
+void Daemon::Set_State(uint32_t Index, uint32_t State)
+{
+  Controller &C = Controllers[Index];
+  if (C.Status.State == State) return;
+  C.Status.State = State;
+  Publish(Index);
+  Broadcast("STATE " + std::to_string(Index) + " " + State_Name(State) + "\n");
+  fprintf(stderr, "%s is %s\n", C.Status.Path, State_Name(State));
+}
+
+void Daemon::Send_Command(uint32_t Index, const uint8_t *Command, uint64_t Now)
+{
+  Controller &C = Controllers[Index];
+  C.Tx.append((const char *)Command, Command_Length);
+  C.Awaiting = true;
+  C.Sent_ns = Now;
+  Flush_Controller(Index);
+}
+
+void Daemon::Flush_Controller(uint32_t Index)
+{
+  Controller &C = Controllers[Index];
+  while (!C.Tx.empty())
+  {
+    ssize_t Written = write(C.Fd, C.Tx.data(), C.Tx.size());
+    if (Written < 0)
+    {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN) C.Tx.clear(); // The read side will notice the port has gone
+      break;
+    }
+    C.Tx.erase(0, Written);
+  }
+
+  // Only ask epoll about writability while there is something waiting, otherwise it would wake us up constantly
+  struct epoll_event Event = {};
+  Event.events = EPOLLIN | (C.Tx.empty() ? 0u : (uint32_t)EPOLLOUT);
+  Event.data.u64 = Event_Tag(Source_Controller, Index);
+  epoll_ctl(Epoll_Fd, EPOLL_CTL_MOD, C.Fd, &Event);
+}
+
+void Daemon::Read_Controller(uint32_t Index, uint64_t Now, bool Hung_Up)
+{
+  Controller &C = Controllers[Index];
+  char Buffer[1024];
+
+  while (true)
+  {
+    ssize_t Got = read(C.Fd, Buffer, sizeof(Buffer));
+    if (Got > 0)
+    {
+      C.Rx.append(Buffer, Got);
+      continue;
+    }
+    if (Got < 0 && (errno == EAGAIN || errno == EINTR)) break;
+    if (Got == 0 && !Hung_Up) break; // A raw tty with VMIN and VTIME at 0 returns 0 when there is nothing to read, it only means end of file after a hang up
+
+    // Unplugged or otherwise gone
+    Retry_Later(Index, Now, Port_Offline);
+    return;
+  }
+
+  if (C.Status.State == Port_Discovering)
+  {
+    if (C.Rx.find(Discovery_Reply) != std::string::npos)
+    {
+      C.Rx.clear();
+      C.Awaiting = false;
+      C.Was_Online = true;
+      C.Retry_Delay_ms = Settings.Retry_ms;
+      C.Next_ns = Now;
+      Set_State(Index, Port_Online);
+    }
+    else if (C.Rx.size() > 4096)
+    {
+      C.Rx.erase(0, C.Rx.size() - 16); // Something chatty that is not answering us, keep only enough to spot VM200G across two reads
+    }
+    return;
+  }
+
+  // A command timed out and the line has not been quiet long enough yet. Anything arriving now belongs to an old command.
+  if (C.Draining)
+  {
+    if (!C.Rx.empty()) C.Quiet_Since_ns = Now;
+    C.Rx.clear();
+    return;
+  }
+
+  // Online: cut status frames out of the stream. Anything not starting with $ (fault messages, leftovers) is skipped.
+  while (!C.Rx.empty())
+  {
+    size_t Start = C.Rx.find('$');
+    if (Start == std::string::npos)
+    {
+      C.Rx.clear();
+      break;
+    }
+    C.Rx.erase(0, Start);
+    if (C.Rx.size() < Status_Length) break;
+
+    Status_Frame Frame;
+    if (!Parse_Status((const uint8_t *)C.Rx.data(), Frame))
+    {
+      C.Rx.erase(0, 1); // That $ was not the start of a frame, look for the next one
+      continue;
+    }
+    C.Rx.erase(0, Status_Length);
+    if (!C.Awaiting) continue; // Late reply to a command that already timed out
+
+    C.Awaiting = false;
+    C.Missed = 0;
+    C.Next_ns = C.Sent_ns + (uint64_t)Settings.Interval_ms * 1000000ull;
+    C.Status.Goal_Position = Frame.Goal_Position;
+    C.Status.Present_Position = Frame.Present_Position;
+    C.Status.Moving = Frame.Moving;
+    C.Status.Error = Frame.Error;
+    C.Status.Updated_ns = Now;
+    C.Status.Polls++;
+    Publish(Index);
+    if (C.Goal_In_Flight)
+    {
+      Answer_Goal_Waiters(C.In_Flight_Waiters, "OK GOAL " + std::to_string(Index) + " " + std::to_string(C.In_Flight_Goal) + "\n");
+      C.Goal_In_Flight = false;
+    }
+    Broadcast("STATUS " + std::to_string(Index) + " " + std::to_string(Frame.Goal_Position) + " " + std::to_string(Frame.Present_Position) + " " +
+              std::to_string(Frame.Moving) + " " + std::to_string(Frame.Error) + "\n");
+  }
+}
+
+// Deals with timeouts and retries, and sends the next command if one is due
+void Daemon::Service_Controller(uint32_t Index, uint64_t Now)
+{
+  Controller &C = Controllers[Index];
+
+  switch (C.Status.State)
+  {
+    case Port_Discovering:
+      if (C.Awaiting && Now - C.Sent_ns >= (uint64_t)Settings.Discovery_Timeout_ms * 1000000ull)
+      {
+        // Something that answers with other text is probably not a controller, but it could be one stuck in Fault_Condition, so it is still tried again later
+        Retry_Later(Index, Now, C.Rx.empty() ? Port_Offline : Port_Ignored);
+      }
+      break;
+
+    case Port_Online:
+      if (C.Awaiting && Now - C.Sent_ns >= (uint64_t)Settings.Timeout_ms * 1000000ull)
+      {
+        C.Awaiting = false;
+        C.Rx.clear();
+        C.Missed++;
+        C.Status.Timeouts++;
+        Publish(Index);
+        Requeue_Goal(Index);
+        if (C.Missed >= Settings.Max_Missed)
+        {
+          Retry_Later(Index, Now, Port_Offline);
+          break;
+        }
+        tcflush(C.Fd, TCIFLUSH); // Throw away what has already arrived, then wait for the rest of a late reply to stop coming
+        C.Draining = true;
+        C.Quiet_Since_ns = Now;
+        C.Next_ns = Now;
+      }
+      if (C.Draining)
+      {
+        if (Now - C.Quiet_Since_ns < (uint64_t)Settings.Timeout_ms * 1000000ull) break;
+        C.Draining = false;
+        C.Rx.clear();
+      }
+      if (!C.Awaiting && Now >= C.Next_ns)
+      {
+        uint8_t Command[Command_Length];
+        if (C.Goal_Pending)
+        {
+          Build_Goal_Command(C.Goal, Command); // Answers with a status frame too, so it takes the place of this poll
+          C.Goal_Pending = false;
+          C.Goal_In_Flight = true;
+          C.In_Flight_Goal = C.Goal;
+          C.In_Flight_Waiters.swap(C.Goal_Waiters);
+        }
+        else
+        {
+          memcpy(Command, Poll_Command, Command_Length);
+        }
+        Send_Command(Index, Command, Now);
+      }
+      break;
+
+    case Port_Offline:
+    case Port_Ignored:
+      if (C.Fd < 0 && Now >= C.Next_ns) Open_Controller(Index, Now);
+      break;
+
+    default:
+      break;
+  }
+}
+
+void Daemon::Publish(uint32_t Index)
+{
+  Write_Port_Status(Table->Ports[Index], Controllers[Index].Status);
+}
+
+// ********************************************************************************************************************************************************************************************
+// Clients
+// ********************************************************************************************************************************************************************************************
+
+void Daemon::Accept_Clients()
+{
+  while (true)
+  {
+    int Fd = accept4(Listen_Fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (Fd < 0) break;
+
+    struct epoll_event Event = {};
+    Event.events = EPOLLIN;
+    Event.data.u64 = Event_Tag(Source_Client, (uint32_t)Fd);
+    epoll_ctl(Epoll_Fd, EPOLL_CTL_ADD, Fd, &Event);
+    Clients[Fd].Fd = Fd;
+  }
+}
+
+void Daemon::Read_Client(int Fd)
+{
+  Client &Who = Clients[Fd];
+  char Buffer[1024];
+
+  while (true)
+  {
+    ssize_t Got = read(Fd, Buffer, sizeof(Buffer));
+    if (Got > 0)
+    {
+      Who.Rx.append(Buffer, Got);
+      continue;
+    }
+    if (Got < 0 && (errno == EAGAIN || errno == EINTR)) break;
+    Drop_Client(Fd); // Closed by the other end
+    return;
+  }
+
+  size_t End;
+  while ((End = Who.Rx.find('\n')) != std::string::npos)
+  {
+    std::string Line = Who.Rx.substr(0, End);
+    Who.Rx.erase(0, End + 1);
+    if (!Line.empty() && Line.back() == '\r') Line.pop_back();
+    Handle_Client_Line(Who, Line);
+  }
+  if (Who.Rx.size() > Client_Rx_Limit) Drop_Client(Fd);
+}
+
+void Daemon::Handle_Client_Line(Client &Who, const std::string &Line)
+{
+  char Word[16] = "";
+  sscanf(Line.c_str(), "%15s", Word);
+
+  if (strcmp(Word, "LIST") == 0)
+  {
+    for (uint32_t x = 0; x < Controllers.size(); x++)
+    {
+      Who.Tx += "PORT " + std::to_string(x) + " " + Controllers[x].Status.Path + " " + State_Name(Controllers[x].Status.State) + "\n";
+    }
+    Who.Tx += "END\n";
+  }
+  else if (strcmp(Word, "SUB") == 0)
+  {
+    Who.Subscribed = true;
+    Who.Tx += "OK\n";
+  }
+  else if (strcmp(Word, "UNSUB") == 0)
+  {
+    Who.Subscribed = false;
+    Who.Tx += "OK\n";
+  }
+  else if (strcmp(Word, "SHM") == 0)
+  {
+    Who.Tx += "SHM " + Settings.Shm_Name + "\n";
+  }
+  else if (strcmp(Word, "GOAL") == 0)
+  {
+    char          Index_Text[32], Position_Text[32], Extra[2];
+    long          Index, Position;
+    if (sscanf(Line.c_str(), "%*15s %31s %31s %1s", Index_Text, Position_Text, Extra) != 2 ||
+        !Parse_Number(Index_Text, 0, Snapshot_Max_Ports - 1, Index) || !Parse_Number(Position_Text, INT32_MIN, INT32_MAX, Position))
+    {
+      Who.Tx += "ERR usage GOAL <index> <position>\n";
+    }
+    else if ((size_t)Index >= Controllers.size() || Controllers[Index].Status.State != Port_Online)
+    {
+      Who.Tx += "ERR controller not online\n";
+    }
+    else
+    {
+      Controller &C = Controllers[Index];
+      if (C.Goal_Pending)
+      {
+        Answer_Goal_Waiters(C.Goal_Waiters, "ERR GOAL " + std::to_string(Index) + " replaced by a newer goal\n");
+      }
+      C.Goal = (int32_t)Position;
+      C.Goal_Pending = true; // Goes out in place of the next poll, and is answered when its status frame comes back
+      C.Goal_Waiters.push_back(Who.Fd);
+    }
+  }
+  else
+  {
+    Who.Tx += "ERR unknown command\n";
+  }
+}
+
+void Daemon::Broadcast(const std::string &Line)
+{
+  for (auto &Entry : Clients)
+  {
+    if (Entry.second.Subscribed) Entry.second.Tx += Line; // Sent at the end of the loop pass
+  }
+}
+
+void Daemon::Flush_Client(int Fd)
+{
+  Client &Who = Clients[Fd];
+  while (!Who.Tx.empty())
+  {
+    ssize_t Written = send(Fd, Who.Tx.data(), Who.Tx.size(), MSG_NOSIGNAL);
+    if (Written < 0)
+    {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) break;
+      Drop_Client(Fd);
+      return;
+    }
+    Who.Tx.erase(0, Written);
+  }
+
+  if (Who.Tx.size() > Client_Tx_Limit)
+  {
+    fprintf(stderr, "Dropping client %d, it is not keeping up\n", Fd);
+    Drop_Client(Fd);
+    return;
+  }
+
+  struct epoll_event Event = {};
+  Event.events = EPOLLIN | (Who.Tx.empty() ? 0u : (uint32_t)EPOLLOUT);
+  Event.data.u64 = Event_Tag(Source_Client, (uint32_t)Fd);
+  epoll_ctl(Epoll_Fd, EPOLL_CTL_MOD, Fd, &Event);
+}
+
+void Daemon::Drop_Client(int Fd)
+{
+  for (Controller &C : Controllers)
+  {
+    C.Goal_Waiters.erase(std::remove(C.Goal_Waiters.begin(), C.Goal_Waiters.end(), Fd), C.Goal_Waiters.end());
+    C.In_Flight_Waiters.erase(std::remove(C.In_Flight_Waiters.begin(), C.In_Flight_Waiters.end(), Fd), C.In_Flight_Waiters.end());
+  }
+  epoll_ctl(Epoll_Fd, EPOLL_CTL_DEL, Fd, nullptr);
+  close(Fd);
+  Clients.erase(Fd);
+}
+
+// ********************************************************************************************************************************************************************************************
+// Command line
+// ********************************************************************************************************************************************************************************************
+
+static void Usage()
+{
+  fprintf(stderr,
+    "Usage: VM200_Daemon [options]\n"
+    "  --ports PATTERN            Serial ports to look at, may be given more than once (default /dev/ttyACM*)\n"
+    "  --baud N                   Line speed (default 115200)\n"
+    "  --interval-ms N            Shortest time between commands to one controller (default 10, 0 for as fast as it answers)\n"
+    "  --timeout-ms N             Status reply timeout (default 250)\n"
+    "  --discovery-timeout-ms N   VM200G reply timeout (default 1000)\n"
+    "  --max-missed N             Timeouts in a row before a controller is offline (default 5)\n"
+    "  --retry-ms N               How often to look for offline controllers (default 2000)\n"
+    "  --max-retry-ms N           Longest wait between tries on ports that have never answered (default 60000)\n"
+    "  --rescan-ms N              How often to look for new ports (default 5000)\n"
+    "  --socket PATH              Client socket (default /tmp/VM200_Daemon.sock)\n"
+    "  --shm NAME                 Shared memory name (default /VM200_Daemon)\n");
+}
+
+static bool Parse_Arguments(int argc, char **argv, Daemon_Settings &Settings)
+{
+  for (int x = 1; x < argc; x++)
+  {
+    std::string Option = argv[x];
+    if (x + 1 >= argc) return false;
+    const char *Value = argv[++x];
+
+    if (Option == "--ports") Settings.Patterns.push_back(Value);
+    else if (Option == "--baud") Settings.Baud = atol(Value);
+    else if (Option == "--interval-ms") Settings.Interval_ms = atol(Value);
+    else if (Option == "--timeout-ms") Settings.Timeout_ms = atol(Value);
+    else if (Option == "--discovery-timeout-ms") Settings.Discovery_Timeout_ms = atol(Value);
+    else if (Option == "--max-missed") Settings.Max_Missed = atol(Value);
+    else if (Option == "--retry-ms") Settings.Retry_ms = atol(Value);
+    else if (Option == "--max-retry-ms") Settings.Max_Retry_ms = atol(Value);
+    else if (Option == "--rescan-ms") Settings.Rescan_ms = atol(Value);
+    else if (Option == "--socket") Settings.Socket_Path = Value;
+    else if (Option == "--shm") Settings.Shm_Name = Value;
+    else return false;
+  }
+  if (Settings.Patterns.empty()) Settings.Patterns.push_back("/dev/ttyACM*");
+  return Baud_To_Speed(Settings.Baud) != 0 && Settings.Interval_ms >= 0 && Settings.Timeout_ms > 0 && Settings.Discovery_Timeout_ms > 0 &&
+         Settings.Max_Missed > 0 && Settings.Retry_ms > 0 && Settings.Max_Retry_ms >= Settings.Retry_ms && Settings.Rescan_ms > 0;
+}
+
+int main(int argc, char **argv)
+{
+  Daemon_Settings Settings;
+  if (!Parse_Arguments(argc, argv, Settings))
+  {
+    Usage();
+    return 2;
+  }
+
+  Daemon Fleet(Settings);
+  if (Fleet.Start())
+  {
+    Fleet.Run();
+    Fleet.Stop();
+    return 0;
+  }
+  Fleet.Stop();
+  return 1;
+}
@@ -0,0 +1,26 @@
+// ********************************************************************************************************************************************************************************************
+// Host stand in for the Adafruit FRAM SPI library. The MRAM is just 32KB of memory (MR25H256) that starts out blank every time Controller_Sim starts.
+// ********************************************************************************************************************************************************************************************
+
+#pragma once
+
+#include "Arduino.h"
+
+class Adafruit_FRAM_SPI
+{
+public:
+  explicit Adafruit_FRAM_SPI(int8_t) {}
+
+  bool    begin(uint8_t = 2) { return true; }
+  bool    writeEnable(bool Enable) { Write_Enabled = Enable; return true; }
+  uint8_t read8(uint32_t Address) { return Memory[Address % sizeof(Memory)]; }
+  bool    write8(uint32_t Address, uint8_t Value)
+  {
+    if (Write_Enabled) Memory[Address % sizeof(Memory)] = Value; // Like the real chip, writes without writeEnable(true) first are ignored
+    return true;
+  }
+
+private:
+  uint8_t Memory[32768] = {};
+  bool    Write_Enabled = false;
+};
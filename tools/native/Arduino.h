@@ -0,0 +1,126 @@
+// ********************************************************************************************************************************************************************************************
+// Host stand in for the Arduino core, so that src/main.cpp can be built and run on a Linux PC by tools/Controller_Sim.cpp
+// ********************************************************************************************************************************************************************************************
+
+// Only the parts of the Arduino core that the firmware actually uses are here. PC_SERIAL (Serial) is one end of a pty with every byte paced at a modeled baud rate, millis() and
+// delay() use the PC's clock, and delay() keeps the serial port moving while it waits, the same way the Teensy's USB serial keeps going in the background.
+// Everything that is not inline is in tools/Controller_Sim.cpp.
+//
+// The Teensy is an ARM, where char is unsigned. Build with -funsigned-char, otherwise the checksum and position byte maths in Serial_Parse do not match the real controller.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <deque>
+#include <string>
+
+typedef uint8_t       byte;
+typedef bool          boolean;
+typedef unsigned int  word;
+
+const uint8_t SS = 10;                            // Hardware SPI chip select pin on the Teensy 4.0
+
+// ********************************************************************************************************************************************************************************************
+// Time
+// ********************************************************************************************************************************************************************************************
+
+uint64_t      Native_Now_ns();                    // CLOCK_MONOTONIC in nanoseconds
+void          Native_Wait_Until(uint64_t Deadline_ns); // Keeps the serial port moving until Deadline_ns. Used by delay() and by the simulated Dynamixel bus.
+unsigned long millis();
+unsigned long micros();
+void          delay(unsigned long ms);
+
+// ********************************************************************************************************************************************************************************************
+// Arduino helpers the firmware uses
+// ********************************************************************************************************************************************************************************************
+
+#define F(Text) (Text)                            // No flash strings on a PC
+
+template <typename T> inline uint8_t lowByte(T Value) { return (uint8_t)(Value & 0xFF); }
+template <typename T> inline uint8_t highByte(T Value) { return (uint8_t)((Value >> 8) & 0xFF); }
+template <typename T, typename L, typename H> inline T constrain(T Value, L Low, H High) { return Value < Low ? (T)Low : (Value > High ? (T)High : Value); }
+
+inline word makeWord(uint8_t High, uint8_t Low) { return ((word)High << 8) | Low; }
+#define word(...) makeWord(__VA_ARGS__)           // Same trick as the Arduino core, so "word" is both a type and a function
+
+// Just enough of String for (String)"text" + number
+class String
+{
+public:
+  String(const char *Text = "") : Text(Text) {}
+  const char *c_str() const { return Text.c_str(); }
+
+  friend String operator+(const String &Left, const char *Right) { return String((Left.Text + Right).c_str()); }
+  friend String operator+(const String &Left, const String &Right) { return String((Left.Text + Right.Text).c_str()); }
+  friend String operator+(const String &Left, int Right) { return String((Left.Text + std::to_string(Right)).c_str()); }
+  friend String operator+(const String &Left, unsigned int Right) { return String((Left.Text + std::to_string(Right)).c_str()); }
+  friend String operator+(const String &Left, long Right) { return String((Left.Text + std::to_string(Right)).c_str()); }
+  friend String operator+(const String &Left, unsigned long Right) { return String((Left.Text + std::to_string(Right)).c_str()); }
+
+private:
+  std::string Text;
+};
+
+// ********************************************************************************************************************************************************************************************
+// Serial ports. Serial (PC_SERIAL) is attached to a pty by Controller_Sim, Serial1 (DXL_SERIAL) is never used directly because the Dynamixel bus is simulated in Dynamixel2Arduino.h.
+// ********************************************************************************************************************************************************************************************
+
+class HardwareSerial
+{
+public:
+  void    begin(unsigned long) {}                 // The line speed is set with Controller_Sim --baud instead
+  explicit operator bool() const { return true; } // Like the Teensy's USB serial once the PC has the port open
+
+  int     available();
+  int     peek();
+  int     read();
+  size_t  write(uint8_t Value);
+  size_t  write(const char *Text) { size_t Length = strlen(Text); for (size_t x = 0; x < Length; x++) write((uint8_t)Text[x]); return Length; }
+
+  size_t  print(const char *Text) { return write(Text); }
+  size_t  print(const String &Text) { return write(Text.c_str()); }
+  size_t  print(char Value) { return write((uint8_t)Value); }
+  size_t  print(unsigned char Value) { return print((unsigned long)Value); }
+  size_t  print(int Value) { return print((long)Value); }
+  size_t  print(unsigned int Value) { return print((unsigned long)Value); }
+  size_t  print(long Value) { return write(std::to_string(Value).c_str()); }
+  size_t  print(unsigned long Value) { return write(std::to_string(Value).c_str()); }
+  size_t  print(double Value) { char Text[64]; snprintf(Text, sizeof(Text), "%.2f", Value); return write(Text); }
+
+  size_t  println() { return write("\r\n"); }
+  template <typename T> size_t println(const T &Value) { size_t Length = print(Value); return Length + println(); }
+
+  // Used by Controller_Sim, not by the firmware
+  void     Attach(int Fd, long Baud);            // Every byte takes 10 bit times at Baud in both directions, 0 for no line model
+  void     Service(uint64_t Now);                 // Reads whatever the PC sent and writes every byte whose last bit would have gone out by Now
+  uint64_t Next_Event_ns(uint64_t Now) const;     // When the next byte finishes arriving or is due to go out, UINT64_MAX if nothing is waiting
+  uint64_t Reads() const { return Read_Count; }   // Bytes the firmware has read, so Controller_Sim can tell if loop() did anything
+
+private:
+  struct Timed_Byte
+  {
+    uint64_t  Time_ns;                            // When the last bit of this byte arrives (Rx) or goes out (Tx)
+    uint8_t   Value;
+  };
+
+  int                     Fd = -1;
+  uint64_t                Byte_Time_ns = 0;
+  std::deque<Timed_Byte>  Rx;                     // Receive buffer, with arrival times
+  std::deque<Timed_Byte>  Tx;                     // Bytes still on their way to the PC
+  uint64_t                Rx_Line_Free_ns = 0;    // When the PC to controller line is free for the next byte
+  uint64_t                Tx_Line_Free_ns = 0;    // When the controller to PC line is free for the next byte
+  uint64_t                Read_Count = 0;
+
+  size_t   Arrived(uint64_t Now) const;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+void setup();
+void loop();
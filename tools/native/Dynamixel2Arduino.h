@@ -0,0 +1,154 @@
+// ********************************************************************************************************************************************************************************************
+// Host stand in for the Dynamixel2Arduino library, with a simulated Dynamixel on the other end of the bus
+// ********************************************************************************************************************************************************************************************
+
+// Only the calls the firmware makes are here, with the same names and arguments as the real library. Instead of talking to a servo, every call charges the time the Protocol 2.0
+// packets would take on the bus at the baud rate given to begin() (57600 in setup()), plus the servo's return delay, by waiting that long. That way a change that adds pings or
+// control table reads to Serial_Parse shows up in Serial_Bench's numbers exactly like it would on a real controller.
+//
+// Packet sizes (Protocol 2.0): an instruction is 10 bytes plus its parameters, a status packet is 11 bytes plus its parameters.
+//   ping:  10 out, 14 back          read:  14 out, 11 + item size back          write: 12 + item size out, 11 back
+//
+// The simulated Dynamixel keeps its control table in memory. The present position moves towards the goal position at Native_Servo.Speed counts per second and MOVING is 1 until it
+// gets there. Controller_Sim fills in Native_Servo from its command line before setup() runs.
+
+#pragma once
+
+#include "Arduino.h"
+#include <map>
+
+namespace ControlTableItem
+{
+  enum ControlTableItemIndex
+  {
+    ID,
+    OPERATING_MODE,
+    HOMING_OFFSET,
+    VELOCITY_LIMIT,
+    TORQUE_ENABLE,
+    POSITION_P_GAIN,
+    GOAL_VELOCITY,
+    GOAL_POSITION,
+    MOVING,
+    PRESENT_POSITION,
+    HARDWARE_ERROR_STATUS,
+    MULTI_TURN_OFFSET
+  };
+}
+
+enum OperatingMode
+{
+  OP_CURRENT = 0,
+  OP_VELOCITY,
+  OP_POSITION,
+  OP_EXTENDED_POSITION,
+  OP_CURRENT_BASED_POSITION,
+  OP_PWM
+};
+
+typedef uint32_t DXLLibErrorCode_t;
+const DXLLibErrorCode_t DXL_LIB_OK = 0;
+
+struct Native_Servo_Settings
+{
+  uint8_t       Id = 1;                           // ID the simulated Dynamixel answers to, same as DXL_ID in setup.h
+  long          Speed = 20000;                    // How fast the present position moves, counts per second
+  int32_t       Start_Position = 0;               // Present and goal position at power up
+  long          Return_Delay_us = 500;            // Return Delay Time, the Dynamixel's default of 250 is 500us
+};
+
+extern Native_Servo_Settings Native_Servo;
+
+class Dynamixel2Arduino
+{
+public:
+  Dynamixel2Arduino(HardwareSerial &, int) {}
+
+  void begin(unsigned long Baud)
+  {
+    Bus_Baud = Baud;
+    Table[ControlTableItem::ID] = Native_Servo.Id;
+    Table[ControlTableItem::OPERATING_MODE] = 3;  // Position control, the factory setting
+    Table[ControlTableItem::GOAL_POSITION] = Native_Servo.Start_Position;
+    Present = Native_Servo.Start_Position;
+    Updated_ns = Native_Now_ns();
+  }
+
+  bool setPortProtocolVersion(float) { return true; }
+
+  bool ping(uint8_t Id)
+  {
+    Bus_Transfer(10, 14);
+    return Id == Native_Servo.Id;
+  }
+
+  int32_t readControlTableItem(uint8_t Item, uint8_t Id, uint32_t = 100)
+  {
+    Bus_Transfer(14, 11 + Item_Size(Item));
+    if (Id != Native_Servo.Id) return 0;
+
+    Move();
+    if (Item == ControlTableItem::PRESENT_POSITION) return (int32_t)lround(Present);
+    if (Item == ControlTableItem::MOVING) return lround(Present) != Table[ControlTableItem::GOAL_POSITION] ? 1 : 0;
+    return Table[Item];
+  }
+
+  bool writeControlTableItem(uint8_t Item, uint8_t Id, int32_t Data, uint32_t = 100)
+  {
+    Bus_Transfer(12 + Item_Size(Item), 11);
+    if (Id != Native_Servo.Id) return false;
+
+    Move();
+    Table[Item] = Data;
+    return true;
+  }
+
+  // Same as the library: the position is passed as a float, so very large positions lose their lowest bits. Out of range floats saturate like the Teensy's VCVT instruction does.
+  bool setGoalPosition(uint8_t Id, float Value)
+  {
+    int32_t Position = Value >= 2147483647.0f ? INT32_MAX : Value <= -2147483648.0f ? INT32_MIN : (int32_t)Value;
+    return writeControlTableItem(ControlTableItem::GOAL_POSITION, Id, Position);
+  }
+  bool setOperatingMode(uint8_t Id, uint8_t Mode) { return writeControlTableItem(ControlTableItem::OPERATING_MODE, Id, Mode == OP_EXTENDED_POSITION ? 4 : Mode == OP_POSITION ? 3 : Mode); }
+  bool torqueOn(uint8_t Id) { return writeControlTableItem(ControlTableItem::TORQUE_ENABLE, Id, 1); }
+  bool torqueOff(uint8_t Id) { return writeControlTableItem(ControlTableItem::TORQUE_ENABLE, Id, 0); }
+  DXLLibErrorCode_t getLastLibErrCode() const { return DXL_LIB_OK; }
+
+private:
+  unsigned long           Bus_Baud = 0;
+  std::map<uint8_t, int32_t> Table;               // Control table, anything never written reads 0
+  double                  Present = 0;            // Present position, kept as a double so slow speeds still move
+  uint64_t                Updated_ns = 0;         // When Present was last moved
+
+  static size_t Item_Size(uint8_t Item)
+  {
+    switch (Item)
+    {
+      case ControlTableItem::ID:
+      case ControlTableItem::OPERATING_MODE:
+      case ControlTableItem::TORQUE_ENABLE:
+      case ControlTableItem::MOVING:
+      case ControlTableItem::HARDWARE_ERROR_STATUS: return 1;
+      default:                                      return 4;
+    }
+  }
+
+  // Waits as long as the packets would take on the bus, 10 bits per byte, plus the return delay
+  void Bus_Transfer(size_t Sent, size_t Answer)
+  {
+    if (Bus_Baud == 0) return;
+    uint64_t Bus_ns = (Sent + Answer) * 10000000000ull / Bus_Baud + (uint64_t)Native_Servo.Return_Delay_us * 1000ull;
+    Native_Wait_Until(Native_Now_ns() + Bus_ns);
+  }
+
+  void Move()
+  {
+    uint64_t Now = Native_Now_ns();
+    if (Now <= Updated_ns) return;
+    double Step = Native_Servo.Speed * (Now - Updated_ns) / 1e9;
+    double Goal = Table[ControlTableItem::GOAL_POSITION];
+    Updated_ns = Now;
+    if (fabs(Goal - Present) <= Step) Present = Goal;
+    else Present += (Goal > Present) ? Step : -Step;
+  }
+};
@@ -0,0 +1,3 @@
+// Host stand in for the Arduino SPI library. Nothing in it is needed, the MRAM is simulated in Adafruit_FRAM_SPI.h.
+
+#pragma once
@@ -0,0 +1,3 @@
+// Host stand in for the Arduino Wire library. Nothing in it is needed, it is only included because the FRAM library wants it.
+
+#pragma once